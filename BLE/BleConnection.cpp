@@ -1,6 +1,7 @@
 #include "Debugging.h"
 #include "BleConnection.h"
 
+#include <algorithm>
 #include <cstring>
 
 #ifdef MOCK_PICO_PI
@@ -118,6 +119,11 @@ uint16_t BleConnection::getMtu() const {
     return bt_mtu;
 }
 
+uint16_t BleConnection::getMaxFrameSize() const {
+    //a notification or write without response carries the MTU less the opcode and attribute handle
+    return (bt_mtu ? bt_mtu : att_default_mtu) - 3;
+}
+
 void BleConnection::setRole(uint8_t the_role) {
     role = the_role;
 }
@@ -130,6 +136,63 @@ gatt_client_notification_t *BleConnection::getNotificationListener() {
     return &notification_listener;
 }
 
+btstack_context_callback_registration_t *BleConnection::getSendRequestRegistration() {
+    return &send_request_registration;
+}
+
+bool BleConnection::isSendRequestPending() const {
+    return send_request_pending;
+}
+
+void BleConnection::setSendRequestPending(const bool pending) {
+    send_request_pending = pending;
+}
+
+uint8_t BleConnection::getPacketsInFlight() const {
+    return packets_in_flight;
+}
+
+void BleConnection::setPacketsInFlight(const uint8_t count) {
+    packets_in_flight = count;
+}
+
+uint8_t BleConnection::getSlot() const {
+    return slot;
+}
+
+void BleConnection::setSlot(const uint8_t index) {
+    slot = index;
+}
+
+uint8_t BleConnection::addPreparedWrite(const uint16_t offset, const uint8_t *data, const uint16_t size) {
+    if (offset > prepared_write.size()) {
+        return ATT_ERROR_INVALID_OFFSET;
+    }
+    if (offset + size > max_prepared_write_size) {
+        return ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+    }
+    //a part sent again overwrites what was there
+    prepared_write.resize(std::max(prepared_write.size(), static_cast<size_t>(offset + size)));
+    std::copy_n(data, size, prepared_write.begin() + offset);
+    return 0;
+}
+
+const std::vector<uint8_t> &BleConnection::getPreparedWrite() const {
+    return prepared_write;
+}
+
+void BleConnection::clearPreparedWrite() {
+    prepared_write = {}; //gives the memory back, long writes are rare
+}
+
+TxQueue &BleConnection::getTxQueue() {
+    return tx_queue;
+}
+
+const TxQueue &BleConnection::getTxQueue() const {
+    return tx_queue;
+}
+
 bool BleConnection::canAndNeedToDiscoverBitchatCharacteristicsQuery(gatt_client_service_t &service) const {
     if (bitchat_service_start_group_handle > 0 && bitchat_characteristic_value_handle == 0) {
         LOG_DEBUG("populated service for query\n");
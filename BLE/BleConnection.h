@@ -4,10 +4,14 @@
 #include <functional>
 #include <map>
 #include <string>
+#include <vector>
+
+#include "TxQueue.h"
 
 #ifdef MOCK_PICO_PI
 #include "../test/bitchat_repeater_mocks.h"
 #else
+#include "btstack_config.h"
 #include "bluetooth.h"
 #include "ble/gatt_client.h"
 #endif
@@ -23,6 +27,10 @@ const uint8_t bitchat_characteristic_uuid[] = {
     0xA1, 0xB2, 0xC3, 0xD4, 0xE5, 0xF6, 0x4A, 0x5B, 0x8C, 0x9D, 0x0E, 0x1F, 0x2A, 0x3B, 0x4C, 0x5D
 };
 
+constexpr uint16_t att_default_mtu = 23; //until an exchange says otherwise
+//Largest frame a client can send as a long write, only held while the write is in progress
+constexpr uint16_t max_prepared_write_size = 2048;
+
 enum service_uuid_check_status {
     ServiceUUIDNotFound = 0,
     ServiceUUIDFound = 0b1,
@@ -81,12 +89,39 @@ public:
 
     [[nodiscard]] uint16_t getMtu() const;
 
+    [[nodiscard]] uint16_t getMaxFrameSize() const;
+
     void setRole(uint8_t role);
 
     [[nodiscard]] uint8_t getRole() const;
 
     gatt_client_notification_t *getNotificationListener();
 
+    btstack_context_callback_registration_t *getSendRequestRegistration();
+
+    [[nodiscard]] bool isSendRequestPending() const;
+
+    void setSendRequestPending(bool pending);
+
+    [[nodiscard]] uint8_t getPacketsInFlight() const;
+
+    void setPacketsInFlight(uint8_t count);
+
+    [[nodiscard]] uint8_t getSlot() const;
+
+    void setSlot(uint8_t index);
+
+    //collects one part of a long write, an att error if it leaves a gap or goes past max_prepared_write_size
+    uint8_t addPreparedWrite(uint16_t offset, const uint8_t *data, uint16_t size);
+
+    [[nodiscard]] const std::vector<uint8_t> &getPreparedWrite() const;
+
+    void clearPreparedWrite();
+
+    TxQueue &getTxQueue();
+
+    [[nodiscard]] const TxQueue &getTxQueue() const;
+
 private:
     hci_con_handle_t connection_handle = 0;
     bd_addr_t bt_address{};
@@ -103,4 +138,15 @@ private:
     uint8_t role = HCI_ROLE_INVALID;
     uint64_t last_seen_time = 0;
     gatt_client_notification_t notification_listener{};
+    //each connection keeps its own can-send registration so outstanding requests don't overwrite each other
+    btstack_context_callback_registration_t send_request_registration{};
+    bool send_request_pending = false;
+    //frames handed to the controller that it has not yet reported as completed
+    uint8_t packets_in_flight = 0;
+    //bit index into each packet's delivered mask, allocated by the tracker while the connection is live
+    uint8_t slot = no_connection_slot;
+    //encoded frames waiting for btstack to let this connection send
+    TxQueue tx_queue{};
+    //parts of a long write from the client, put together by offset until it is executed or cancelled
+    std::vector<uint8_t> prepared_write{};
 };
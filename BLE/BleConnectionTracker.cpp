@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <limits>
+#include <tuple>
 
 #include "Debugging.h"
 #include "BleConnectionTracker.h"
@@ -15,14 +16,16 @@
 #include "../test/bitchat_repeater_mocks.h"
 #include "../test/pico_pi_mocks.h"
 #else
-#include "pico/time.h"
 #include "hardware/timer.h"
 #include "ble/att_server.h"
 #endif
 
 extern BleConnectionTracker *connection_tracker_ptr;
-static btstack_context_callback_registration_t notify_context_callback_registration;
-static btstack_context_callback_registration_t write_context_callback_registration;
+
+constexpr uint32_t tx_quantum_bytes = 517; //one maximum size ATT frame per connection per round
+//What a new packet or neighbour would add to, only pressure on these turns one away
+constexpr std::array admission_stores{memory_store_messages, memory_store_packets, memory_store_tx_lists};
+constexpr std::array neighbour_stores{memory_store_neighbours};
 
 void bitchat_can_send_notification_handler(void *context) {
     LOG_DEBUG("bitchat_can_send_notification_handler(0x%02x)\n", context);
@@ -46,37 +49,205 @@ void bitchat_can_write_without_response_handler(void *context) {
         connection_tracker_ptr->writeRawPacket(con_handle);
 }
 
+static bool fragmentHeaderOf(const PacketBase &packet, FragmentHeader &header) {
+    switch (packet.getPacketType()) {
+        case type_fragment_start:
+        case fragmentContinue:
+        case fragmentEnd:
+            return FragmentHeader::parse(static_cast<const PacketPassAlong &>(packet).getPayload(), header);
+        default:
+            return false;
+    }
+}
+
+//relayed fragments are grouped by the fragment id at the start of their payload
+static uint64_t fragmentGroupOf(const PacketBase &packet) {
+    FragmentHeader header;
+    return fragmentHeaderOf(packet, header) ? header.fragment_id : 0;
+}
+
+//the fragment id ProtocolWriter wrote at the start of each fragment's payload when it cut the set
+static uint64_t fragmentGroupOf(const std::vector<EncodedFrame> &fragments) {
+    const auto &first = *fragments.front();
+    PacketView view;
+    FragmentHeader header;
+    if (!PacketView::parse(first.data(), 0, first.size(), view) ||
+        !FragmentHeader::parse({reinterpret_cast<const char *>(view.payload.data()), view.payload.size()}, header)) {
+        return 0;
+    }
+    return header.fragment_id;
+}
+
 BleConnection &BleConnectionTracker::connectionForConnHandle(const hci_con_handle_t connection_handle) {
     if (const auto search = connections.find(connection_handle); search != connections.end()) {
-        return connections[connection_handle];
+        return search->second;
     }
-    connections[connection_handle].setConnectionHandle(connection_handle);
-    return connections[connection_handle];
+    auto &connection = trackedConnection(connection_handle);
+    connection.setConnectionHandle(connection_handle);
+    return connection;
 }
 
-const Message *BleConnectionTracker::storeMessageAndReturnIfNew(Message &message) {
-    const auto id = message.getMessageId();
-    if (const auto search = messages.find(id); search != messages.end()) {
-        return nullptr; //message was found so it not new
+BleConnection &BleConnectionTracker::trackedConnection(const hci_con_handle_t connection_handle) {
+    const auto [item, inserted] = connections.try_emplace(connection_handle);
+    if (inserted) {
+        scheduleExpiry(expiry_connection, connection_handle, item->second.getTimestampMs() + ten_minutes_in_ms);
     }
-    messages[id] = std::move(message);
-    return &messages[id];
+    return item->second;
+}
+
+//neighbours are keyed by their address as a string, the wheel holds the same six bytes as a number
+static uint64_t neighbourKey(const std::string &address) {
+    uint64_t key = 0;
+    memcpy(&key, address.data(), std::min(address.size(), sizeof(key)));
+    return key;
+}
+
+static std::string neighbourAddress(const uint64_t key) {
+    return {reinterpret_cast<const char *>(&key), BD_ADDR_LEN};
+}
+
+//the hash only narrows the search, the id itself is compared so two ids sharing a hash stay apart
+static uint64_t messageKey(const std::string_view id) {
+    return PacketHasher().add(id).finish();
 }
 
-const PacketPassAlong *BleConnectionTracker::storePacketAndReturnIfNew(PacketPassAlong &pass_along) {
+static PacketHandle findMessage(const auto &messages, const std::string_view id) {
+    return messages.find(messageKey(id), [id](const Message &message) {
+        return message.getMessageId() == id;
+    });
+}
+
+PacketHandle BleConnectionTracker::storeMessageAndReturnIfNew(Message &message) {
+    const auto &id = message.getMessageId();
+    if (findMessage(messages, id)) {
+        return {}; //message was found so it not new
+    }
+    const auto key = messageKey(id);
+    //what it holds until the stores are next measured
+    memory_budget.charge(memory_store_messages, message.getHeldBytes());
+    const auto handle = messages.insert(key, std::move(message));
+    scheduleExpiry(expiry_message, handle.getValue(), time_us_64() / 1000 + ten_minutes_in_ms);
+    return handle;
+}
+
+PacketHandle BleConnectionTracker::storePacketAndReturnIfNew(PacketPassAlong &pass_along) {
     const auto id = pass_along.getPacketHash();
-    if (const auto search = packets.find(id); search != packets.end()) {
-        return nullptr; //packet was found so it not new
+    if (packets.find(id)) {
+        return {}; //packet was found so it not new
+    }
+    if (FragmentHeader header; fragmentHeaderOf(pass_along, header) && header.total > packets.capacity()) {
+        //the whole group could never be held at once, storing any of it would only push out packets that can go
+        if (auto &group = fragment_groups[header.fragment_id]; !group.isRejected()) {
+            group.reject(time_us_64());
+            fragment_groups_oversize++;
+        }
+        return {};
+    }
+    memory_budget.charge(memory_store_packets, pass_along.getHeldBytes());
+    //a full store makes room with a packet that isn't waiting on the rest of its fragment group, the oldest of them
+    const auto handle = packets.insert(id, std::move(pass_along), [this](const PacketPassAlong &stored) {
+        return std::pair(isPendingFragment(stored), stored.getPacketTimestamp());
+    });
+    scheduleExpiry(expiry_packet, handle.getValue(), time_us_64() / 1000 + ten_minutes_in_ms);
+    return handle;
+}
+
+const PacketBase *BleConnectionTracker::packetForHandle(const PacketHandle handle) const {
+    switch (handle.getPool()) {
+        case packet_pool_messages:
+            return messages.get(handle);
+        case packet_pool_pass_along:
+            return packets.get(handle);
+        case packet_pool_announce:
+            return handle == announce_handle ? &announce : nullptr;
+        default:
+            return nullptr;
     }
-    packets[id] = std::move(pass_along);
-    return &packets[id];
 }
 
 Message *BleConnectionTracker::messageWithId(const std::string &id) {
-    if (const auto search = messages.find(id); search != messages.end()) {
-        return &search->second;
+    return messages.get(findMessage(messages, id));
+}
+
+bool BleConnectionTracker::hasMessageWithId(const std::string_view id) const {
+    return static_cast<bool>(findMessage(messages, id));
+}
+
+bool BleConnectionTracker::hasPacketWithHash(const uint64_t hash) const {
+    return static_cast<bool>(packets.find(hash));
+}
+
+constexpr uint64_t MESSAGE_TIMEOUT = 300000L; //5mins in ms
+
+bool BleConnectionTracker::admitPacket(const PacketView &packet) {
+    const auto type = packet.type;
+    const bool read_here = type == type_message || type == type_announce || type == noiseIdentityAnnounce;
+    if (packet.ttl < 1 && !read_here) {
+        admission_rejects[admission_reject_ttl]++;
+        return false;
     }
-    return nullptr;
+    //announces are what set our clock so they are let through whatever time they carry
+    if (timestamp_offset_ms >= build_time_ms && type != type_announce) {
+        const auto now = getTimeMs();
+        if (packet.timestamp_ms + MESSAGE_TIMEOUT < now) {
+            admission_rejects[admission_reject_too_old]++;
+            return false;
+        }
+        if (packet.timestamp_ms > now + MESSAGE_TIMEOUT) {
+            admission_rejects[admission_reject_future]++;
+            return false;
+        }
+    }
+    const auto key = packet.admissionKey();
+    const auto admitted = admitted_packets.find(key);
+    if (admitted == admitted_packets.end()) {
+        if (seen_filter.contains(key)) {
+            admission_rejects[admission_reject_seen]++;
+            return false;
+        }
+        if (isOverBudget(admission_stores)) {
+            admission_rejects[admission_reject_memory]++;
+            memory_budget.countRefusal();
+            return false;
+        }
+        return true;
+    }
+    //a copy of an announce with more ttl left came by a shorter path, which tells us where the peer is
+    if (!(type == type_announce && packet.ttl > admitted->second.ttl)) {
+        admission_rejects[admission_reject_duplicate]++;
+        return false;
+    }
+    admitted->second.ttl = packet.ttl;
+    return true;
+}
+
+void BleConnectionTracker::recordAdmission(const PacketView &packet) {
+    const auto key = packet.admissionKey();
+    if (admitted_packets.contains(key)) {
+        return; //a shorter path for an announce, admitPacket has already updated it
+    }
+    //kept by when it arrived here, the sender's clock may be well out
+    const auto now_ms = time_us_64() / 1000;
+    if (scheduleExpiry(expiry_admitted, key, now_ms + ten_minutes_in_ms)) {
+        admitted_packets.emplace(key, AdmittedPacket{now_ms, packet.ttl});
+    }
+    seen_filter.insert(key, now_ms);
+}
+
+const AdmissionRejectCounts &BleConnectionTracker::getAdmissionRejects() const {
+    return admission_rejects;
+}
+
+const SeenFilter &BleConnectionTracker::getSeenFilter() const {
+    return seen_filter;
+}
+
+void BleConnectionTracker::countMessageReject(const MessageReject reason) {
+    message_rejects[reason]++;
+}
+
+const MessageRejectCounts &BleConnectionTracker::getMessageRejects() const {
+    return message_rejects;
 }
 
 Peer *BleConnectionTracker::peerWithId(const uint64_t id) {
@@ -87,35 +258,131 @@ Peer *BleConnectionTracker::peerWithId(const uint64_t id) {
 }
 
 Peer &BleConnectionTracker::checkSenderInPeers(const uint64_t sender) {
-    if (const auto search = peers.find(sender); search == peers.end()) {
-        peers[sender].setId(sender);
+    const auto now_ms = time_us_64() / 1000;
+    auto search = peers.find(sender);
+    if (search == peers.end()) {
+        if (peers.size() >= max_peers) {
+            evictLeastRecentPeer();
+            peer_evictions++;
+        }
+        search = peers.try_emplace(sender).first;
+        search->second.setId(sender);
+        scheduleExpiry(expiry_peer, sender, now_ms + peer_idle_ms);
     }
-    return peers[sender];
+    search->second.setLastSeenMs(now_ms);
+    return search->second;
 }
 
-void BleConnectionTracker::enqueueTargetedPacket(const PacketBase *packet, BleConnection *to_connection) {
-    if (packet->getPacketTtl() > 0) {
+size_t BleConnectionTracker::getPeersCount() const {
+    return peers.size();
+}
+
+uint32_t BleConnectionTracker::getPeerEvictions() const {
+    return peer_evictions;
+}
+
+void BleConnectionTracker::enqueueTargetedPacket(const PacketHandle packet, BleConnection *to_connection) {
+    if (const auto stored = packetForHandle(packet); stored && stored->getPacketTtl() > 0) {
         auto con = &connectionForConnHandle(to_connection->getConnectionHandle());
         targeted_packets_to_send_list.emplace(packet, con);
     }
 }
 
-void BleConnectionTracker::enqueueBroadcastPacket(const PacketBase *packet) {
-    if (packet->getPacketTtl() > 0) {
+void BleConnectionTracker::enqueueBroadcastPacket(const PacketHandle packet) {
+    if (const auto stored = packetForHandle(packet); stored && stored->getPacketTtl() > 0) {
         broadcast_packets_to_send_list.push_back(packet);
     }
 }
 
-void BleConnectionTracker::enqueueBroadcastPacket(const PacketBase *packet, BleConnection *from_connection,
-                                                  Peer *from_peer) {
-    packets_connections_sent_list.emplace(packet, from_connection);
-    packets_peers_sent_list.emplace(packet, from_peer);
+void BleConnectionTracker::enqueueBroadcastPacket(const PacketHandle packet, BleConnection *from_connection,
+                                                  const uint64_t from_peer_id) {
+    const auto stored = packetForHandle(packet);
+    if (!stored) {
+        return;
+    }
+    stored->markDeliveredTo(connectionSlot(connectionForConnHandle(from_connection->getConnectionHandle())));
+    packets_peers_sent_list.emplace(packet, from_peer_id);
     enqueueBroadcastPacket(packet);
 }
 
+void BleConnectionTracker::enqueueFragmentPacket(const PacketHandle packet, BleConnection *from_connection,
+                                                 const uint64_t from_peer_id) {
+    const auto fragment = packets.get(packet);
+    if (!fragment) {
+        return;
+    }
+    fragment->markDeliveredTo(connectionSlot(connectionForConnHandle(from_connection->getConnectionHandle())));
+    packets_peers_sent_list.emplace(packet, from_peer_id);
+    FragmentHeader header;
+    if (fragment->getPacketTtl() == 0 || !FragmentHeader::parse(fragment->getPayload(), header)) {
+        return;
+    }
+    auto &group = fragment_groups[header.fragment_id];
+    const auto payload_size = fragment->getPayload().size();
+    if (!group.addFragment(header, fragment->getPacketHash(), payload_size, time_us_64())) {
+        return;
+    }
+    incomplete_fragment_bytes += payload_size;
+    if (!group.isComplete()) {
+        return; //a partial group is never relayed, the missing fragments may not arrive
+    }
+    incomplete_fragment_bytes -= group.getBytes();
+    std::vector<PacketHandle> members;
+    for (const auto packet_hash: group.getFragments() | std::views::values) {
+        if (const auto member = packets.find(packet_hash)) {
+            members.push_back(member);
+        }
+    }
+    if (members.size() == group.getTotal()) {
+        //queued back to back in index order so the group goes out together
+        for (const auto member: members) {
+            enqueueBroadcastPacket(member);
+        }
+    } else {
+        //some went from the store before the rest arrived, the ones left can never be relayed
+        fragment_groups_incomplete++;
+        for (const auto member: members) {
+            dropPacket(member, memory_store_packets);
+        }
+    }
+    fragment_groups.erase(header.fragment_id);
+}
+
+void BleConnectionTracker::expireFragmentGroups() {
+    const auto now = time_us_64();
+    for (auto item = fragment_groups.begin(); item != fragment_groups.end();) {
+        const auto &group = item->second;
+        if (group.getFirstSeenUs() + thirty_seconds_in_us > now) {
+            ++item;
+            continue;
+        }
+        if (group.isRejected()) {
+            item = fragment_groups.erase(item);
+            continue;
+        }
+        //incomplete for too long, drop every fragment of it rather than hold or relay a part
+        incomplete_fragment_bytes -= group.getBytes();
+        for (const auto packet_hash: group.getFragments() | std::views::values) {
+            if (const auto member = packets.find(packet_hash)) {
+                dropPacket(member, memory_store_packets);
+            }
+        }
+        fragment_groups_expired++;
+        item = fragment_groups.erase(item);
+    }
+}
+
 void BleConnectionTracker::addAvailablePeer(const bd_addr_t &bt_address, const bd_addr_type_t bt_address_type,
                                             const service_uuid_check_status services, const int8_t rssi) {
     const auto address = std::string(reinterpret_cast<const char *>(bt_address), BD_ADDR_LEN);
+    if (!available_neighbours.contains(address)) {
+        if (isOverBudget(neighbour_stores)) {
+            memory_budget.countRefusal();
+            return;
+        }
+        //seen again and again while advertising, it is checked when due and put back if it was seen since
+        scheduleExpiry(expiry_neighbour, neighbourKey(address), time_us_64() / 1000 + ten_minutes_in_ms);
+    }
     available_neighbours[address].setBleAddress(bt_address, bt_address_type);
     available_neighbours[address].setServices(services);
     available_neighbours[address].setRssi(rssi);
@@ -125,14 +392,16 @@ void BleConnectionTracker::addAvailablePeer(const bd_addr_t &bt_address, const b
 void BleConnectionTracker::reportConnection(const uint16_t handle, const bd_addr_t &addr,
                                             const bd_addr_type_t address_type) {
     const auto address = std::string(reinterpret_cast<const char *>(addr), BD_ADDR_LEN);
+    auto &connection = trackedConnection(handle);
     if (const auto item = available_neighbours.find(address); item != available_neighbours.end()) {
-        connections[handle] = item->second;
+        releaseConnectionSlot(connection);
+        connection = item->second;
         available_neighbours.erase(address);
     }
-    connections[handle].setConnectionHandle(handle);
-    connections[handle].setConnected(true);
-    connections[handle].setBleAddress(addr, address_type);
-    connections[handle].setTimestamp(time_us_64());
+    connection.setConnectionHandle(handle);
+    connection.setConnected(true);
+    connection.setBleAddress(addr, address_type);
+    connection.setTimestamp(time_us_64());
     available_neighbours.erase(address);
 }
 
@@ -158,18 +427,20 @@ void BleConnectionTracker::reportDisconnection(const uint16_t handle) {
     auto &removed_connection = connections[handle];
     removed_connection.setNotificationEnabled(false);
     removed_connection.setConnected(false);
+    removed_connection.setSendRequestPending(false); //btstack drops outstanding requests with the connection
+    removed_connection.getTxQueue().clear(tx_drops);
+    removed_connection.clearPreparedWrite();
+    inbound_ring.discard(handle);
+    removed_connection.setHasData(false);
+    reportPacketsCompleted(handle, removed_connection.getPacketsInFlight());
 
     if (removed_connection.getRole() == HCI_ROLE_MASTER) {
         gatt_client_stop_listening_for_characteristic_value_updates(removed_connection.getNotificationListener());
     }
-    auto announced_to_connection = [this, removed_connection](const auto &item) {
-        const auto &[packet, connection] = item;
-
-        return packet == &announce && connection == &removed_connection;
-    };
+    //frees the slot and forgets what was delivered on it, so a reconnect gets announced to again
+    releaseConnectionSlot(removed_connection);
     const auto handle_peers_removed = handle_peer_map.erase(handle);
-    const auto announce_packets_removed = std::erase_if(packets_connections_sent_list, announced_to_connection);
-    LOG_DEBUG("disconnection - removed announce packets: %d, handle_peers_removed: %d\n", announce_packets_removed, handle_peers_removed);
+    LOG_DEBUG("disconnection - handle_peers_removed: %zu\n", handle_peers_removed);
 }
 
 std::vector<BleConnection *> BleConnectionTracker::getConnectableNeighbours() {
@@ -215,23 +486,75 @@ void BleConnectionTracker::printStats() {
             active_connections_count++;
         }
     }
-    LOG_DEBUG("con: %d/%d, avail: %d, messages:%d, packets:%d, broadcast: %d, targeted: %d\n", active_connections_count,
-              connections.size(), available_neighbours.size(), messages.size(), packets.size(),
-              broadcast_packets_to_send_list.size(),
-              targeted_packets_to_send_list.size());
+    LOG_DEBUG("con: %d/%zu, avail: %zu, messages:%u, packets:%u, broadcast: %zu, targeted: %zu, "
+              "packets/event: %.2f\n", active_connections_count, connections.size(), available_neighbours.size(),
+              messages.size(), packets.size(), broadcast_packets_to_send_list.size(),
+              targeted_packets_to_send_list.size(), getPacketsPerConnectionEvent());
+    LOG_DEBUG("packet pools - messages: %u/%u, packets: %u/%u, evicted: %" PRIu32 ", stale handles: %" PRIu32 "\n",
+              messages.size(), messages.capacity(), packets.size(), packets.capacity(),
+              messages.getEvictions() + packets.getEvictions(), stale_handles);
+    const auto &control = tx_wait_stats[tx_class_control];
+    const auto &normal = tx_wait_stats[tx_class_normal];
+    const auto &bulk = tx_wait_stats[tx_class_bulk];
+    LOG_DEBUG("tx wait avg/max ms - control: %" PRIu32 "/%" PRIu32 ", normal: %" PRIu32 "/%" PRIu32 ", bulk: %" PRIu32
+              "/%" PRIu32 "\n",
+              static_cast<uint32_t>(control.averageUs() / 1000), static_cast<uint32_t>(control.max_us / 1000),
+              static_cast<uint32_t>(normal.averageUs() / 1000), static_cast<uint32_t>(normal.max_us / 1000),
+              static_cast<uint32_t>(bulk.averageUs() / 1000), static_cast<uint32_t>(bulk.max_us / 1000));
+    LOG_DEBUG("tx drops - frames: %" PRIu32 ", bytes: %" PRIu32 ", oversize: %" PRIu32 ", disconnected: %" PRIu32
+              ", fragment group: %" PRIu32 "\n",
+              tx_drops[tx_drop_frame_budget], tx_drops[tx_drop_byte_budget], tx_drops[tx_drop_oversize],
+              tx_drops[tx_drop_disconnected], tx_drops[tx_drop_fragment_group]);
+    LOG_DEBUG("fragment groups - incomplete: %zu, bytes held: %zu, expired: %" PRIu32 ", oversize: %" PRIu32
+              ", members evicted: %" PRIu32 "\n",
+              getFragmentGroupsCount(), incomplete_fragment_bytes, fragment_groups_expired, fragment_groups_oversize,
+              fragment_groups_incomplete);
+    LOG_DEBUG("inbound ring - depth: %" PRIu32 ", high water: %" PRIu32 ", overflow drops: %" PRIu32
+              ", discarded: %" PRIu32 "\n",
+              inbound_ring.getDepth(), inbound_ring.getHighWater(), inbound_ring.getOverflowDrops(),
+              inbound_ring.getDiscarded());
+    LOG_DEBUG("admission rejects - ttl: %" PRIu32 ", too old: %" PRIu32 ", future: %" PRIu32 ", duplicate: %" PRIu32
+              ", seen: %" PRIu32 ", memory: %" PRIu32 ", admitted: %zu\n",
+              admission_rejects[admission_reject_ttl], admission_rejects[admission_reject_too_old],
+              admission_rejects[admission_reject_future], admission_rejects[admission_reject_duplicate],
+              admission_rejects[admission_reject_seen], admission_rejects[admission_reject_memory],
+              admitted_packets.size());
+    LOG_DEBUG("seen filter - keys: %" PRIu32 ", fill: %.1f%%, false positive: %.3f%%\n", seen_filter.getKeys(),
+              seen_filter.getFill() * 100, seen_filter.getFalsePositiveRate() * 100);
+    LOG_DEBUG("expiry - scheduled: %u/%u, overflows: %" PRIu32 ", expired messages: %" PRIu32
+              ", packets: %" PRIu32 ", admitted: %" PRIu32 ", connections: %" PRIu32 ", neighbours: %" PRIu32
+              ", peers: %" PRIu32 "\n", expiry_wheel.size(), expiry_wheel_capacity,
+              expiry_overflows, expired[expiry_message], expired[expiry_packet], expired[expiry_admitted],
+              expired[expiry_connection], expired[expiry_neighbour], expired[expiry_peer]);
+    LOG_DEBUG("peers - %zu/%u, evicted: %" PRIu32 ", idle: %" PRIu32 "\n", peers.size(), max_peers,
+              peer_evictions, expired[expiry_peer]);
+    LOG_DEBUG("memory - messages: %" PRIu32 "/%" PRIu32 ", packets: %" PRIu32 "/%" PRIu32 ", peers: %" PRIu32 "/%"
+              PRIu32 ", tx lists: %" PRIu32 "/%" PRIu32 ", neighbours: %" PRIu32 "/%" PRIu32 ", connections: %"
+              PRIu32 "/%" PRIu32 ", total: %" PRIu32 "/%" PRIu32 ", pressure: %s\n",
+              memory_budget.getUsed(memory_store_messages), memory_budget.getBudget(memory_store_messages),
+              memory_budget.getUsed(memory_store_packets), memory_budget.getBudget(memory_store_packets),
+              memory_budget.getUsed(memory_store_peers), memory_budget.getBudget(memory_store_peers),
+              memory_budget.getUsed(memory_store_tx_lists), memory_budget.getBudget(memory_store_tx_lists),
+              memory_budget.getUsed(memory_store_neighbours), memory_budget.getBudget(memory_store_neighbours),
+              memory_budget.getUsed(memory_store_connections), memory_budget.getBudget(memory_store_connections),
+              memory_budget.getTotalUsed(), memory_budget.getTotalBudget(),
+              MemoryBudget::pressureName(memory_budget.getPressure()));
+    LOG_DEBUG("memory evictions - messages: %" PRIu32 ", packets: %" PRIu32 ", peers: %" PRIu32 ", neighbours: %"
+              PRIu32 ", refused: %" PRIu32 "\n",
+              memory_budget.getEvictions(memory_store_messages), memory_budget.getEvictions(memory_store_packets),
+              memory_budget.getEvictions(memory_store_peers), memory_budget.getEvictions(memory_store_neighbours),
+              memory_budget.getRefusals());
+    LOG_DEBUG("message rejects - malformed: %" PRIu32 ", bytes: %" PRIu32 ", allocations: %" PRIu32
+              ", mentions: %" PRIu32 "\n",
+              message_rejects[message_reject_malformed], message_rejects[message_reject_bytes],
+              message_rejects[message_reject_allocations], message_rejects[message_reject_mentions]);
 }
 
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 
 bool BleConnectionTracker::SendPacketToConnection(const PacketBase &packet, BleConnection &ble_connection) {
-    std::vector<uint8_t> packet_data;
-    ProtocolWriter::writePacket(packet_data, &packet);
-
-    if (packet_data.size() > ble_connection.getMtu()) {
-        //TODO - implement fragment creation
-        assert(0);
-    }
+    const auto packet_data = ProtocolWriter::encodedFrame(&packet);
 
     const uint16_t con_handle = ble_connection.getConnectionHandle();
     std::string peer_string{};
@@ -248,29 +571,77 @@ bool BleConnectionTracker::SendPacketToConnection(const PacketBase &packet, BleC
     LOG_DEBUG("SendPacketToConnection - type(%d), peer(%s:0x%" PRIx64 "), hci_connection_for_handle(0x%x), hc(0x%x)\n",
               packet.getPacketType(), peer_string.c_str(), sender_id,
               con_handle, hci_connection);
-    uint8_t status = 0;
+    auto &tx_queue = ble_connection.getTxQueue();
+    const auto now = time_us_64();
+    if (packet_data->size() > ble_connection.getMaxFrameSize()) {
+        //fragments are cut once per frame size and shared by every link that negotiated the same MTU
+        const auto fragments = ProtocolWriter::encodedFragments(&packet, ble_connection.getMaxFrameSize());
+        if (!fragments) {
+            LOG_DEBUG("SendPacketToConnection(0x%x) - mtu %d too small to fragment into\n", con_handle,
+                      ble_connection.getMtu());
+            tx_drops[tx_drop_oversize]++;
+            return false;
+        }
+        //every fragment carries the id the set was cut under, a resend of the packet starts the group afresh
+        const auto group = fragmentGroupOf(*fragments);
+        tx_queue.startGroup(group);
+        for (const auto &fragment: *fragments) {
+            //a refused fragment takes the rest of its group off the queue, the packet has not gone on this link
+            if (!tx_queue.push(fragment, txClassForPacketType(fragmentContinue), packet.getPacketTtl(), now, tx_drops,
+                               group)) {
+                LOG_DEBUG("SendPacketToConnection(0x%x) - fragments dropped, tx queue full\n", con_handle);
+                return false;
+            }
+        }
+    } else {
+        //a relayed group goes out in index order, its first fragment starts it again on this link
+        FragmentHeader header;
+        const auto group = fragmentHeaderOf(packet, header) ? header.fragment_id : 0;
+        if (header.index == 0) {
+            tx_queue.startGroup(group);
+        }
+        if (!tx_queue.push(packet_data, txClassForPacketType(packet.getPacketType()), packet.getPacketTtl(), now,
+                           tx_drops, group)) {
+            LOG_DEBUG("SendPacketToConnection(0x%x) - dropped, tx queue full\n", con_handle);
+            return false;
+        }
+    }
     ble_connection.setHasData(true);
+    //if btstack turns the request down the frames stay queued and the next pass asks again
+    requestSend(ble_connection);
+    return true;
+}
+
+bool BleConnectionTracker::requestSend(BleConnection &ble_connection) {
+    if (ble_connection.isSendRequestPending()) {
+        return true; //btstack will call back for this connection, that will pick up everything queued
+    }
+    const uint16_t con_handle = ble_connection.getConnectionHandle();
+    const auto registration = ble_connection.getSendRequestRegistration();
+    registration->context = reinterpret_cast<void *>(con_handle);
+    uint8_t status;
     if (ble_connection.getRole() == HCI_ROLE_SLAVE) {
-        raw_packet_to_notify.emplace(con_handle, packet_data);
-        notify_context_callback_registration.callback = &bitchat_can_send_notification_handler;
-        notify_context_callback_registration.context = reinterpret_cast<void *>(con_handle);
-        status = att_server_request_to_send_notification(&notify_context_callback_registration, con_handle);
+        registration->callback = &bitchat_can_send_notification_handler;
+        status = att_server_request_to_send_notification(registration, con_handle);
     } else {
-        raw_packet_to_write.emplace(con_handle, packet_data);
-        write_context_callback_registration.callback = &bitchat_can_write_without_response_handler;
-        write_context_callback_registration.context = reinterpret_cast<void *>(con_handle);
-        status = gatt_client_request_to_write_without_response(&write_context_callback_registration, con_handle);
+        registration->callback = &bitchat_can_write_without_response_handler;
+        status = gatt_client_request_to_write_without_response(registration, con_handle);
     }
     if (status) {
-        LOG_DEBUG("SendPacketToConnection - Write without response failed, status 0x%02x.\n", status);
-        sleep_ms(20);
+        //the frame stays queued, the next sendPackets pass will request again
+        LOG_DEBUG("requestSend(0x%x) - request to send failed, status 0x%02x.\n", con_handle, status);
         return false;
     }
-    sleep_ms(20);
+    ble_connection.setSendRequestPending(true);
     return true;
 }
 
 void BleConnectionTracker::sendPackets() {
+    for (auto &connection: connections | std::views::values) {
+        if (connection.isConnected() && connection.hasData() && !connection.isSendRequestPending()) {
+            requestSend(connection); //an earlier request was refused, try again
+        }
+    }
     if (broadcast_packets_to_send_list.empty() && targeted_packets_to_send_list.empty()) {
         return;
     }
@@ -279,54 +650,67 @@ void BleConnectionTracker::sendPackets() {
     };
     auto available_connections = connections | std::views::values | std::views::filter(available);
 
-    auto packet_needed = [this](const std::pair<const PacketBase *, const BleConnection *> &targeted) {
-        auto [begin, end] = packets_connections_sent_list.equal_range(targeted.first);
-        auto matches_connection = [targeted](const std::pair<const PacketBase *, const BleConnection *> &sent_to) {
-            return sent_to.second->getConnectionHandle() == targeted.second->getConnectionHandle();
-        };
-        return std::ranges::find_if(begin, end, matches_connection) == end;
+    //backpressure, a link that isn't draining its queue only takes control frames until btstack catches up
+    auto backpressured = [](const PacketBase &packet, const BleConnection &connection) {
+        return connection.getTxQueue().isCongested() &&
+               txClassForPacketType(packet.getPacketType()) != tx_class_control;
     };
-    std::set<const PacketBase *> targeted_packets_to_remove;
-    for (const auto &[packet, connection]: targeted_packets_to_send_list | std::views::filter(packet_needed)) {
-        LOG_DEBUG("Sending Targeted Packet %p, 0x%x\n", packet, connection->getConnectionHandle());
-        SendPacketToConnection(*packet, *connection);
-        packets_connections_sent_list.emplace(packet, connection);
-        targeted_packets_to_remove.emplace(packet);
-    }
-    for (auto packet: targeted_packets_to_remove) {
-        auto [being, end] = targeted_packets_to_send_list.equal_range(packet);
-        targeted_packets_to_send_list.erase(being, end);
+    for (auto item = targeted_packets_to_send_list.begin(); item != targeted_packets_to_send_list.end();) {
+        const auto &[handle, connection] = *item;
+        const auto packet = packetForHandle(handle);
+        const auto slot = connectionSlot(*connection);
+        if (!packet) {
+            stale_handles++;
+        } else if (slot != no_connection_slot && !packet->isDeliveredTo(slot)) {
+            if (backpressured(*packet, *connection)) {
+                ++item; //stays listed for a later pass
+                continue;
+            }
+            LOG_DEBUG("Sending Targeted Packet %p, 0x%x\n", packet, connection->getConnectionHandle());
+            if (SendPacketToConnection(*packet, *connection)) {
+                packet->markDeliveredTo(slot);
+            }
+        }
+        item = targeted_packets_to_send_list.erase(item);
     }
 
-    std::set<const PacketBase *> broadcast_packets_to_remove;
-    for (auto packet: broadcast_packets_to_send_list) {
+    std::set<PacketHandle> broadcast_packets_to_remove;
+    for (const auto handle: broadcast_packets_to_send_list) {
+        const auto packet = packetForHandle(handle);
+        if (!packet) {
+            stale_handles++;
+            broadcast_packets_to_remove.emplace(handle);
+            continue;
+        }
         // LOG_DEBUG("Sending Broadcast Packet %p\n", packet);
+        bool deferred = false;
         for (auto &connection: available_connections) {
-            bool sendable = true;
-            for (auto search = packets_connections_sent_list.find(packet);
-                 search != packets_connections_sent_list.end(); ++search) {
-                if (search->second->getConnectionHandle() == connection.getConnectionHandle()) {
-                    // LOG_DEBUG("Not Sendable 0x%x\n", connection.getConnectionHandle());
-                    sendable = false;
-                }
+            //a link without a slot could never be marked delivered and would be sent the packet on every pass
+            const auto slot = connectionSlot(connection);
+            if (slot == no_connection_slot || packet->isDeliveredTo(slot)) {
+                continue;
+            }
+            if (backpressured(*packet, connection)) {
+                deferred = true;
+                continue;
             }
-            if (sendable) {
-                SendPacketToConnection(*packet, connection);
-                packets_connections_sent_list.emplace(packet, &connection);
+            if (SendPacketToConnection(*packet, connection)) {
+                packet->markDeliveredTo(slot);
             }
         }
 
-        broadcast_packets_to_remove.emplace(packet);
+        if (!deferred) {
+            broadcast_packets_to_remove.emplace(handle);
+        }
     }
-    auto sent = [broadcast_packets_to_remove](const PacketBase *packet) {
-        return broadcast_packets_to_remove.contains(packet);
+    auto sent = [&broadcast_packets_to_remove](const PacketHandle handle) {
+        return broadcast_packets_to_remove.contains(handle);
     };
     const auto ret = std::ranges::remove_if(broadcast_packets_to_send_list, sent);
     broadcast_packets_to_send_list.erase(ret.begin(), ret.end());
 }
 #pragma GCC pop_options
 
-constexpr uint64_t MESSAGE_TIMEOUT = 300000L; //5mins in ms
 
 void BleConnectionTracker::possiblyUpdateTimeOffset(const uint64_t timestamp_ms) {
     const uint64_t our_now = getTimeMs();
@@ -376,21 +760,14 @@ void BleConnectionTracker::announceToConnections() {
     };
     auto available_connections = connections | std::views::values | std::views::filter(available);
 
-    auto announced_to = packets_connections_sent_list.equal_range(&announce);
-    auto not_announced_to = [announced_to](const BleConnection &connection) {
-        auto matches_connection = [connection](const std::pair<const PacketBase *, const BleConnection *> &sent_to) {
-            // LOG_DEBUG("announced_to connection(0x%x), available connection(0x%x)\n",sent_to.second->getConnectionHandle(), connection.getConnectionHandle());
-            return sent_to.second->getConnectionHandle() == connection.getConnectionHandle();
-        };
-        const auto ret = std::ranges::find_if(announced_to.first, announced_to.second, matches_connection) ==
-                         announced_to.second;
-        // LOG_DEBUG("not_announced_to: %d\n",ret);
-        return ret;
+    auto not_announced_to = [this](BleConnection &connection) {
+        const auto slot = connectionSlot(connection);
+        return slot != no_connection_slot && !announce.isDeliveredTo(slot);
     };
-    for (auto connection: available_connections | std::views::filter(not_announced_to)) {
+    for (auto &connection: available_connections | std::views::filter(not_announced_to)) {
         LOG_DEBUG("Announce To Connection(0x%x)\n", connection.getConnectionHandle());
         announce.setPacketTimestamp(getTimeMs());
-        enqueueTargetedPacket(&announce, &connection);
+        enqueueTargetedPacket(announce_handle, &connection);
     }
 }
 
@@ -398,65 +775,292 @@ size_t BleConnectionTracker::getTargetedPacketsToSendSize() const {
     return targeted_packets_to_send_list.size();
 }
 
+size_t BleConnectionTracker::getQueuedFrameBytes() const {
+    std::set<const std::vector<uint8_t> *> frames;
+    for (const auto &connection: connections | std::views::values) {
+        for (uint8_t tx_class = 0; tx_class < tx_class_count; tx_class++) {
+            connection.getTxQueue().forEach(static_cast<TxClass>(tx_class), [&frames](const TxEntry &entry) {
+                frames.emplace(entry.frame.get());
+            });
+        }
+    }
+    size_t bytes = 0;
+    for (const auto frame: frames) {
+        bytes += frame->size();
+    }
+    return bytes;
+}
+
+size_t BleConnectionTracker::getIncompleteFragmentBytes() const {
+    return incomplete_fragment_bytes;
+}
+
+size_t BleConnectionTracker::getFragmentGroupsCount() const {
+    return std::ranges::count_if(fragment_groups | std::views::values, [](const FragmentGroup &group) {
+        return !group.isRejected();
+    });
+}
+
+uint32_t BleConnectionTracker::getFragmentGroupsOversize() const {
+    return fragment_groups_oversize;
+}
+
+uint32_t BleConnectionTracker::getFragmentGroupsIncomplete() const {
+    return fragment_groups_incomplete;
+}
+
 PacketBase *BleConnectionTracker::getAnyPacket() {
-    if (!packets.empty()) {
-        return &packets.begin()->second;
+    return packets.get(packets.first());
+}
+
+uint32_t BleConnectionTracker::getStaleHandles() const {
+    return stale_handles;
+}
+
+void BleConnectionTracker::advanceExpiry(const uint32_t budget) {
+    //our own uptime, not getTimeMs, which jumps when a peer sets our clock
+    const auto now_ms = time_us_64() / 1000;
+    expiry_wheel.advance(now_ms, budget, [this, now_ms](const ExpiryEntry &entry) {
+        expire(entry, now_ms);
+    });
+    seen_filter.expire(now_ms);
+    if (memory_measured_ms + memory_measure_interval_ms <= now_ms) {
+        measureMemory();
+        memory_measured_ms = now_ms;
     }
-    return nullptr;
+    relieveMemoryPressure();
 }
 
 void BleConnectionTracker::cleanupStaleItems() {
-    auto now = getTimeMs();
+    advanceExpiry(UINT32_MAX);
+    LOG_DEBUG(
+        "Cleanup items expired: messages(%u), packets(%u), admitted(%u), connections(%u), neighbours(%u), peers(%u)\n",
+        expired[expiry_message], expired[expiry_packet], expired[expiry_admitted], expired[expiry_connection],
+        expired[expiry_neighbour], expired[expiry_peer]);
+}
+
+const ExpiredCounts &BleConnectionTracker::getExpired() const {
+    return expired;
+}
+
+bool BleConnectionTracker::scheduleExpiry(const ExpiryKind kind, const uint64_t key, const uint64_t due_ms) {
+    if (kind != expiry_connection && kind != expiry_neighbour && kind != expiry_peer &&
+        expiry_wheel.size() + expiry_reserved_entries >= expiry_wheel_capacity) {
+        expiry_overflows++;
+        return false;
+    }
+    if (!expiry_wheel.schedule(kind, key, due_ms)) {
+        expiry_overflows++;
+        return false;
+    }
+    return true;
+}
 
-    auto packet_connection_stale = [now](const auto &item) {
-        const auto &[packet, connection] = item;
-        return packet->getPacketTimestamp() + ten_minutes_in_ms < now ||
-               !connection->isConnected() && connection->getTimestampMs() + ten_minutes_in_ms < now;
+void BleConnectionTracker::expire(const ExpiryEntry &entry, const uint64_t now_ms) {
+    //a connection or neighbour seen since it was scheduled goes back on the wheel for when it would next be stale
+    auto stale = [this, &entry, now_ms](const BleConnection &connection) {
+        const auto due_ms = connection.isConnected() ? now_ms + ten_minutes_in_ms
+                                                     : connection.getTimestampMs() + ten_minutes_in_ms;
+        if (due_ms > now_ms) {
+            scheduleExpiry(static_cast<ExpiryKind>(entry.kind), entry.key, due_ms);
+            return false;
+        }
+        expired[entry.kind]++;
+        return true;
+    };
+    switch (entry.kind) {
+        case expiry_message:
+        case expiry_packet: {
+            //a packet evicted or dropped early has already gone, its handle no longer resolves
+            if (const PacketHandle handle(static_cast<uint32_t>(entry.key)); packetForHandle(handle)) {
+                dropPacket(handle, entry.kind == expiry_message ? memory_store_messages : memory_store_packets);
+                expired[entry.kind]++;
+            }
+            break;
+        }
+        case expiry_admitted:
+            if (const auto admitted = admitted_packets.find(entry.key); admitted != admitted_packets.end()) {
+                admitted_packets.erase(admitted);
+                expired[entry.kind]++;
+            }
+            break;
+        case expiry_connection:
+            if (const auto item = connections.find(static_cast<hci_con_handle_t>(entry.key));
+                item != connections.end() && stale(item->second)) {
+                const auto connection = &item->second;
+                std::erase_if(targeted_packets_to_send_list, [connection](const auto &targeted) {
+                    return targeted.second == connection;
+                });
+                releaseConnectionSlot(*connection);
+                connections.erase(item);
+            }
+            break;
+        case expiry_neighbour:
+            if (const auto item = available_neighbours.find(neighbourAddress(entry.key));
+                item != available_neighbours.end() && stale(item->second)) {
+                available_neighbours.erase(item);
+            }
+            break;
+        case expiry_peer:
+            if (const auto item = peers.find(entry.key); item != peers.end()) {
+                if (const auto due_ms = item->second.getLastSeenMs() + peer_idle_ms; due_ms > now_ms) {
+                    scheduleExpiry(expiry_peer, entry.key, due_ms);
+                } else {
+                    peers.erase(item);
+                    expired[entry.kind]++;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void BleConnectionTracker::measureMemory() {
+    size_t message_bytes = 0;
+    messages.forEach([&message_bytes](const Message &message) {
+        message_bytes += message.getHeldBytes();
+    });
+    memory_budget.setUsed(memory_store_messages, message_bytes);
+    size_t packet_bytes = 0;
+    packets.forEach([&packet_bytes](const PacketPassAlong &pass_along) {
+        packet_bytes += pass_along.getHeldBytes();
+    });
+    memory_budget.setUsed(memory_store_packets, packet_bytes);
+    auto node_bytes = [](const auto &map) {
+        return map.size() * (sizeof(typename std::decay_t<decltype(map)>::value_type) + memory_map_node_bytes);
+    };
+    size_t peer_bytes = node_bytes(peers) + node_bytes(handle_peer_map);
+    for (const auto &peer: peers | std::views::values) {
+        peer_bytes += peer.getHeldBytes();
+    }
+    memory_budget.setUsed(memory_store_peers, peer_bytes);
+    memory_budget.setUsed(memory_store_tx_lists, node_bytes(packets_peers_sent_list) +
+                                                 node_bytes(targeted_packets_to_send_list) +
+                                                 broadcast_packets_to_send_list.size() * sizeof(PacketHandle));
+    auto link_bytes = [&node_bytes](const auto &map) {
+        auto bytes = node_bytes(map);
+        for (const auto &connection: map | std::views::values) {
+            bytes += connection.getTxQueue().getHeldBytes();
+        }
+        return bytes;
     };
-    const auto packets_connections_removed = std::erase_if(packets_connections_sent_list, packet_connection_stale);
-    auto packet_peer_stale = [now](const auto &item) {
-        const auto &[packet, peer] = item;
-        return packet->getPacketTimestampMs() + ten_minutes_in_ms < now;
+    memory_budget.setUsed(memory_store_neighbours, link_bytes(available_neighbours));
+    memory_budget.setUsed(memory_store_connections, link_bytes(connections));
+}
+
+void BleConnectionTracker::relieveMemoryPressure() {
+    //fragments waiting on their group last, then fully delivered first, then the fewest hops left, then the oldest
+    auto rank = [this](const PacketBase &packet) {
+        return std::tuple(isPendingFragment(packet), !isFullyDelivered(packet), packet.getPacketTtl(),
+                          packet.getPacketTimestamp());
     };
-    const auto packets_peers_sent_list_removed = std::erase_if(packets_peers_sent_list, packet_peer_stale);
-    auto packet_stale = [now](const auto &packet) {
-        return packet->getPacketTimestampMs() + ten_minutes_in_ms < now;
+    auto under_pressure = [this](const MemoryStore store) {
+        return memory_budget.getPressure(store) != memory_pressure_none ||
+               memory_budget.getTotalPressure() != memory_pressure_none;
     };
-    const auto broadcast_packets_removed = std::erase_if(broadcast_packets_to_send_list, packet_stale);
-    const auto targeted_packets_removed = std::erase_if(targeted_packets_to_send_list, packet_connection_stale);
-    auto connection_stale = [now](const auto &item) {
-        const auto &[key, connection] = item;
-        return !connection.isConnected() && connection.getTimestampMs() + ten_minutes_in_ms < now;
+    for (uint8_t evicted = 0; evicted < memory_evictions_per_pass; evicted++) {
+        if (memory_budget.getPressure(memory_store_neighbours) != memory_pressure_none) {
+            //not connected and seen longest ago, scanning will find it again
+            const auto oldest = std::ranges::min_element(available_neighbours, {}, [](const auto &item) {
+                return std::pair(item.second.isConnected(), item.second.getTimestamp());
+            });
+            if (oldest != available_neighbours.end() && !oldest->second.isConnected()) {
+                memory_budget.release(memory_store_neighbours, sizeof(*oldest) + memory_map_node_bytes);
+                memory_budget.countEviction(memory_store_neighbours);
+                available_neighbours.erase(oldest);
+                continue;
+            }
+        }
+        if (memory_budget.getPressure(memory_store_peers) != memory_pressure_none && !peers.empty()) {
+            evictLeastRecentPeer();
+            memory_budget.countEviction(memory_store_peers);
+            continue;
+        }
+        //the queued lists only shrink as the packets they refer to go
+        const auto message = under_pressure(memory_store_messages) ? messages.lowest(rank) : PacketHandle{};
+        const auto packet = under_pressure(memory_store_packets) || under_pressure(memory_store_tx_lists)
+                                ? packets.lowest(rank)
+                                : PacketHandle{};
+        if (message && (!packet || rank(*messages.get(message)) < rank(*packets.get(packet)))) {
+            evictPacket(message, memory_store_messages);
+        } else if (packet) {
+            evictPacket(packet, memory_store_packets);
+        } else {
+            return;
+        }
+    }
+}
+
+bool BleConnectionTracker::isOverBudget(const std::span<const MemoryStore> stores) {
+    auto hard = [this, stores] {
+        return std::ranges::any_of(stores, [this](const MemoryStore store) {
+            return memory_budget.getPressure(store) == memory_pressure_hard;
+        });
     };
-    const auto connections_removed = std::erase_if(connections, connection_stale);
-    const auto available_neighbours_removed = std::erase_if(available_neighbours, connection_stale);
-    const auto messages_removed = std::erase_if(messages, [now](const auto &item) {
-        const auto &[key, message] = item;
-        return message.getPacketTimestampMs() + ten_minutes_in_ms < now;
-    });
-    const auto packets_removed = std::erase_if(packets, [now](const auto &item) {
-        const auto &[key, packet] = item;
-        return packet.getPacketTimestampMs() + ten_minutes_in_ms < now;
+    if (!hard()) {
+        return false;
+    }
+    relieveMemoryPressure();
+    return hard();
+}
+
+void BleConnectionTracker::evictLeastRecentPeer() {
+    const auto oldest = std::ranges::min_element(peers, {}, [](const auto &item) {
+        return item.second.getLastSeenMs();
     });
+    memory_budget.release(memory_store_peers,
+                          sizeof(*oldest) + memory_map_node_bytes + oldest->second.getHeldBytes());
+    peers.erase(oldest);
+}
 
-    LOG_DEBUG(
-        "Cleanup items removed: connections(%d), neighbours(%d), messages(%d), packets(%d), packet con(%d), packet peer(%d), broadcast(%d), targeted(%d)\n",
-        connections_removed, available_neighbours_removed, messages_removed, packets_removed,
-        packets_connections_removed, packets_peers_sent_list_removed, broadcast_packets_removed,
-        targeted_packets_removed);
+MemoryBudget &BleConnectionTracker::getMemoryBudget() {
+    return memory_budget;
+}
+
+bool BleConnectionTracker::isPendingFragment(const PacketBase &packet) const {
+    const auto group = fragmentGroupOf(packet);
+    return group != 0 && fragment_groups.contains(group);
+}
+
+bool BleConnectionTracker::isFullyDelivered(const PacketBase &packet) const {
+    for (uint8_t slot = 0; slot < sizeof(DeliveryMask) * 8; slot++) {
+        if ((connection_slots_in_use & 1u << slot) != 0 && !packet.isDeliveredTo(slot)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BleConnectionTracker::dropPacket(const PacketHandle handle, const MemoryStore store) {
+    memory_budget.release(store, packetForHandle(handle)->getHeldBytes());
+    forgetHandle(handle);
+    messages.erase(handle);
+    packets.erase(handle);
+}
+
+void BleConnectionTracker::evictPacket(const PacketHandle handle, const MemoryStore store) {
+    memory_budget.countEviction(store);
+    dropPacket(handle, store);
+}
+
+void BleConnectionTracker::forgetHandle(const PacketHandle handle) {
+    packets_peers_sent_list.erase(handle);
+    targeted_packets_to_send_list.erase(handle);
+    std::erase(broadcast_packets_to_send_list, handle);
 }
 
 size_t BleConnectionTracker::getConnectionsCount() const {
     return connections.size() + available_neighbours.size();
 }
 
-void BleConnectionTracker::setConnectionHandleForPeer(const uint16_t con_handle, Peer *peer) {
-    handle_peer_map[con_handle] = peer;
+void BleConnectionTracker::setConnectionHandleForPeer(const uint16_t con_handle, const uint64_t peer_id) {
+    handle_peer_map[con_handle] = peer_id;
 }
 
 Peer *BleConnectionTracker::peerWithConnectionHandle(const uint16_t con_handle) {
     if (const auto search = handle_peer_map.find(con_handle); search != handle_peer_map.end()) {
-        return handle_peer_map[con_handle];
+        return peerWithId(search->second);
     }
     return nullptr;
 }
@@ -471,54 +1075,165 @@ BleConnection *BleConnectionTracker::getConnectionForAddress(const uint8_t *addr
     return nullptr;
 }
 
-void BleConnectionTracker::notifyRawPacket(const hci_con_handle_t con_handle) {
-    auto packets_for_handle = raw_packet_to_notify.equal_range(con_handle);
-    if (packets_for_handle.first != raw_packet_to_notify.end()) {
-        const auto connection = connections[con_handle];
-        assert(connection.hasData());
-        const auto &data = packets_for_handle.first->second;
-        const auto ret = att_server_notify(con_handle, connection.getBitchatCharacteristicValueHandle(), data.data(),
-                                           data.size());
-        if (ret == 0 || ret == ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER) {
-            raw_packet_to_notify.erase(packets_for_handle.first);
-        }
-    }
-    packets_for_handle = raw_packet_to_notify.equal_range(con_handle);
-    if (packets_for_handle.first == raw_packet_to_notify.end()) {
-        auto connection = connections[con_handle];
+template<typename SendFrame>
+void BleConnectionTracker::sendBurst(BleConnection &connection, SendFrame send_frame) {
+    //called from btstack once it can take a frame, so never block in here
+    connection.setSendRequestPending(false);
+    //deficit round robin, each connection event earns a quantum of bytes and re-requesting puts the
+    //connection at the back of btstack's can-send list, so a busy link can't starve the others
+    auto &tx_queue = connection.getTxQueue();
+    tx_queue.setDeficit(std::min(tx_queue.getDeficit() + tx_quantum_bytes, 2 * tx_quantum_bytes));
+    const auto now = time_us_64();
+    uint8_t sent = 0;
+    while (const auto entry = tx_queue.front()) {
+        const auto &frame = *entry->frame;
+        //btstack's own count of free controller buffers, it is what frees them on completed packets
+        if (hci_number_free_acl_slots_for_handle(connection.getConnectionHandle()) <= 0 ||
+            frame.size() > tx_queue.getDeficit()) {
+            break;
+        }
+        const auto ret = send_frame(frame);
+        if (ret == ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER) {
+            tx_queue.clear(tx_drops); //connection has gone, nothing more will be sent on it
+            break;
+        }
+        if (ret != 0) {
+            break; //stack is full until the next can-send
+        }
+        tx_wait_stats[entry->tx_class].record(now - entry->enqueued_us);
+        tx_queue.setDeficit(tx_queue.getDeficit() - frame.size());
+        tx_queue.pop();
+        sent++;
+        connection.setPacketsInFlight(connection.getPacketsInFlight() + 1);
+    }
+    send_connection_events++;
+    send_connection_event_frames += sent;
+    if (tx_queue.empty()) {
+        tx_queue.setDeficit(0);
         connection.setHasData(false);
     } else {
-        notify_context_callback_registration.callback = &bitchat_can_send_notification_handler;
-        notify_context_callback_registration.context = reinterpret_cast<void *>(con_handle);
-        att_server_request_to_send_notification(&notify_context_callback_registration, con_handle);
+        requestSend(connection);
     }
 }
 
+void BleConnectionTracker::notifyRawPacket(const hci_con_handle_t con_handle) {
+    auto &connection = connections[con_handle];
+    sendBurst(connection, [&](const std::vector<uint8_t> &data) {
+        return att_server_notify(con_handle, connection.getBitchatCharacteristicValueHandle(), data.data(),
+                                 data.size());
+    });
+}
+
 void BleConnectionTracker::writeRawPacket(const hci_con_handle_t con_handle) {
-    auto packets_for_handle = raw_packet_to_write.equal_range(con_handle);
-    if (packets_for_handle.first != raw_packet_to_write.end()) {
-        const auto connection = connections[con_handle];
-        assert(connection.hasData());
-        auto &data = packets_for_handle.first->second;
-        const auto ret = gatt_client_write_value_of_characteristic_without_response(
-            con_handle, connection.getBitchatCharacteristicValueHandle(), data.size(), data.data());
-        if (ret == 0 || ret == ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER) {
-            raw_packet_to_write.erase(packets_for_handle.first);
-        }
-    }
-    packets_for_handle = raw_packet_to_write.equal_range(con_handle);
-    if (packets_for_handle.first == raw_packet_to_write.end()) {
-        auto connection = connections[con_handle];
-        connection.setHasData(false);
-    } else {
-        write_context_callback_registration.callback = &bitchat_can_write_without_response_handler;
-        write_context_callback_registration.context = reinterpret_cast<void *>(con_handle);
-        gatt_client_request_to_write_without_response(&write_context_callback_registration, con_handle);
+    auto &connection = connections[con_handle];
+    sendBurst(connection, [&](const std::vector<uint8_t> &data) {
+        return gatt_client_write_value_of_characteristic_without_response(
+            con_handle, connection.getBitchatCharacteristicValueHandle(), data.size(),
+            const_cast<uint8_t *>(data.data()));
+    });
+}
+
+void BleConnectionTracker::reportPacketsCompleted(const hci_con_handle_t con_handle, const uint16_t count) {
+    if (const auto search = connections.find(con_handle); search != connections.end()) {
+        auto &connection = search->second;
+        connection.setPacketsInFlight(connection.getPacketsInFlight() - std::min<uint16_t>(
+                                          count, connection.getPacketsInFlight()));
+    }
+}
+
+const TxWaitStats &BleConnectionTracker::getTxWaitStats(const TxClass tx_class) const {
+    return tx_wait_stats[tx_class];
+}
+
+const TxDropCounts &BleConnectionTracker::getTxDrops() const {
+    return tx_drops;
+}
+
+InboundRing &BleConnectionTracker::getInboundRing() {
+    return inbound_ring;
+}
+
+uint8_t BleConnectionTracker::receiveWrite(const hci_con_handle_t con_handle, const uint16_t transaction_mode,
+                                           const uint16_t offset, const uint8_t *buffer, const uint16_t buffer_size) {
+    auto &connection = connectionForConnHandle(con_handle);
+    switch (transaction_mode) {
+        case ATT_TRANSACTION_MODE_NONE:
+            //the offset is only ever non zero for the parts of a long write
+            inbound_ring.push(con_handle, buffer, buffer_size);
+            return 0;
+        case ATT_TRANSACTION_MODE_ACTIVE:
+            return connection.addPreparedWrite(offset, buffer, buffer_size);
+        case ATT_TRANSACTION_MODE_VALIDATE:
+            return 0; //each part was checked as it arrived
+        case ATT_TRANSACTION_MODE_EXECUTE: {
+            if (const auto &frame = connection.getPreparedWrite(); !frame.empty()) {
+                inbound_ring.push(con_handle, frame.data(), frame.size());
+            }
+            connection.clearPreparedWrite();
+            return 0;
+        }
+        case ATT_TRANSACTION_MODE_CANCEL:
+        default:
+            connection.clearPreparedWrite();
+            return 0;
+    }
+}
+
+float BleConnectionTracker::getPacketsPerConnectionEvent() const {
+    if (send_connection_events == 0) {
+        return 0;
     }
+    return static_cast<float>(send_connection_event_frames) / static_cast<float>(send_connection_events);
+}
+
+uint8_t BleConnectionTracker::connectionSlot(BleConnection &connection) {
+    if (connection.getSlot() != no_connection_slot) {
+        return connection.getSlot();
+    }
+    auto free_slot = [this]() -> uint8_t {
+        for (uint8_t slot = 0; slot < MAX_NR_HCI_CONNECTIONS; slot++) {
+            if ((connection_slots_in_use & (1u << slot)) == 0) {
+                return slot;
+            }
+        }
+        return no_connection_slot;
+    };
+    auto slot = free_slot();
+    if (slot == no_connection_slot) {
+        //reclaim from links that dropped without a disconnection event
+        for (auto &other: connections | std::views::values) {
+            if (!other.isConnected()) {
+                releaseConnectionSlot(other);
+            }
+        }
+        slot = free_slot();
+    }
+    if (slot == no_connection_slot) {
+        LOG_DEBUG("connectionSlot(0x%x) - no free slot\n", connection.getConnectionHandle());
+        return no_connection_slot;
+    }
+    connection_slots_in_use |= 1u << slot;
+    connection.setSlot(slot);
+    return slot;
+}
+
+void BleConnectionTracker::releaseConnectionSlot(BleConnection &connection) {
+    const auto slot = connection.getSlot();
+    if (slot == no_connection_slot) {
+        return;
+    }
+    announce.clearDeliveredTo(slot);
+    auto clear_delivered = [slot](const PacketBase &packet) {
+        packet.clearDeliveredTo(slot);
+    };
+    messages.forEach(clear_delivered);
+    packets.forEach(clear_delivered);
+    connection_slots_in_use &= ~(1u << slot);
+    connection.setSlot(no_connection_slot);
 }
 
 hci_con_handle_t BleConnectionTracker::getAnyDuplicateHandle() {
-    std::map<Peer*, hci_con_handle_t> reversed;
+    std::map<uint64_t, hci_con_handle_t> reversed;
     for (auto &[handle, peer]: handle_peer_map) {
         if (reversed[peer] != 0) {
             //return the earlier connection - appears to get gazumped by the more recent one
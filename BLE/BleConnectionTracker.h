@@ -1,40 +1,142 @@
 #pragma once
 
+#include <array>
 #include <map>
 #include <set>
+#include <span>
 
 #include "BleConnection.h"
+#include "ExpiryWheel.h"
+#include "InboundRing.h"
+#include "MemoryBudget.h"
+#include "PacketPool.h"
+#include "SeenFilter.h"
 #include "../Bitchat/Message.h"
 #include "../Bitchat/Peer.h"
 #include "../Bitchat/Announce.h"
+#include "../Bitchat/FragmentGroup.h"
+#include "../Bitchat/MessageCodec.h"
 #include "../Bitchat/PacketPassAlong.h"
+#include "../Bitchat/PacketView.h"
 
 inline auto build_time_ms = 1755685519; //Occasionally update this, us since 1970
 inline auto two_seconds_in_us = 1000 * 1000 * 2;
+inline auto thirty_seconds_in_us = 1000 * 1000 * 30;
 inline auto two_minutes_in_us = 1000 * 1000 * 60 * 5;
 inline auto five_minutes_in_us = 1000 * 1000 * 60 * 5;
 inline auto ten_minutes_in_us = 1000 * 1000 * 60 * 10;
 inline auto ten_minutes_in_ms = 1000 * 60 * 10;
 
+//Why an inbound frame was turned away on its header alone
+enum AdmissionReject : uint8_t {
+    admission_reject_ttl = 0, //nothing here reads it and it can't be passed along
+    admission_reject_too_old, //timestamp further behind our clock than packets are kept for
+    admission_reject_future, //timestamp further ahead of our clock than any peer should drift
+    admission_reject_duplicate, //a copy of a packet already admitted
+    admission_reject_seen, //a copy arriving after the admission record was cleaned up, caught by the seen filter
+    admission_reject_memory, //hard memory pressure, nothing new is taken on until something has been let go
+    admission_reject_count
+};
+
+using AdmissionRejectCounts = std::array<uint32_t, admission_reject_count>;
+
+//Slots set aside for stored packets, past these the oldest is evicted to make room
+constexpr uint16_t max_stored_messages = 64;
+constexpr uint16_t max_stored_packets = 128;
+
+//Which store a PacketHandle points into, our own announce lives outside the pools under a fixed handle
+enum PacketPoolId : uint8_t {
+    packet_pool_messages = 0,
+    packet_pool_pass_along,
+    packet_pool_announce
+};
+
+constexpr PacketHandle announce_handle{packet_pool_announce, 0, 1};
+
+//What is kept of an admitted packet to recognise its copies, received_ms is our uptime when it arrived
+struct AdmittedPacket {
+    uint64_t received_ms = 0;
+    uint8_t ttl = 0;
+};
+
+//What an expiry wheel entry refers to, everything is let go ten minutes after it was received or last seen
+enum ExpiryKind : uint8_t {
+    expiry_message = 0, //key is the PacketHandle value
+    expiry_packet, //key is the PacketHandle value
+    expiry_admitted, //key is the admission key
+    expiry_connection, //key is the connection handle
+    expiry_neighbour, //key is the bluetooth address
+    expiry_peer, //key is the peer id
+    expiry_kind_count
+};
+
+using ExpiredCounts = std::array<uint32_t, expiry_kind_count>;
+
+//Wheel entries looked at per main loop pass, keeps expiry from stalling the loop
+constexpr uint32_t expiry_work_budget = 32;
+//Peers kept, past this the one seen longest ago makes room. One not heard from for half an hour is let go anyway
+constexpr uint16_t max_peers = 128;
+constexpr uint32_t peer_idle_ms = 30 * 60 * 1000;
+
+//Wheel entries kept back for connections, neighbours and peers, nothing else lets them go. A flood of packets fills
+//the rest, past which stored packets are left to pool eviction and admission records to the seen filter
+constexpr uint16_t expiry_reserved_entries = 64 + max_peers;
+
+//Packets, peers or neighbours evicted per main loop pass while under memory pressure
+constexpr uint8_t memory_evictions_per_pass = 4;
+
 class BleConnectionTracker {
 public:
     BleConnection &connectionForConnHandle(hci_con_handle_t connection_handle);
 
-    const Message *storeMessageAndReturnIfNew(Message &message);
+    //an empty handle if the message or packet was already stored
+    PacketHandle storeMessageAndReturnIfNew(Message &message);
 
-    const PacketPassAlong *storePacketAndReturnIfNew(PacketPassAlong &pass_along);
+    PacketHandle storePacketAndReturnIfNew(PacketPassAlong &pass_along);
+
+    //nullptr once the packet has been cleaned up or evicted
+    [[nodiscard]] const PacketBase *packetForHandle(PacketHandle handle) const;
 
     Message *messageWithId(const std::string &id);
 
+    [[nodiscard]] bool hasMessageWithId(std::string_view id) const;
+
+    [[nodiscard]] bool hasPacketWithHash(uint64_t hash) const;
+
+    //decides from the header alone whether a frame is worth parsing
+    bool admitPacket(const PacketView &packet);
+
+    //once the payload has been accepted, so later copies are turned away. A copy that fails to decompress or parse is
+    //not recorded and leaves the way open for a good one
+    void recordAdmission(const PacketView &packet);
+
+    [[nodiscard]] const AdmissionRejectCounts &getAdmissionRejects() const;
+
+    [[nodiscard]] const SeenFilter &getSeenFilter() const;
+
+    void countMessageReject(MessageReject reason);
+
+    [[nodiscard]] const MessageRejectCounts &getMessageRejects() const;
+
+    //peers are referred to by id, the pointer is only good until the next peer is added
     Peer *peerWithId(uint64_t id);
 
+    //adds the peer if it is new, evicting the one seen longest ago when the table is full, and marks it seen
     Peer &checkSenderInPeers(uint64_t sender);
 
-    void enqueueTargetedPacket(const PacketBase *packet, BleConnection *to_connection);
+    [[nodiscard]] size_t getPeersCount() const;
+
+    [[nodiscard]] uint32_t getPeerEvictions() const;
+
+    void enqueueTargetedPacket(PacketHandle packet, BleConnection *to_connection);
+
+    void enqueueBroadcastPacket(PacketHandle packet);
 
-    void enqueueBroadcastPacket(const PacketBase *packet);
+    void enqueueBroadcastPacket(PacketHandle packet, BleConnection *from_connection, uint64_t from_peer_id);
 
-    void enqueueBroadcastPacket(const PacketBase *packet, BleConnection *from_connection, Peer *from_peer);
+    void enqueueFragmentPacket(PacketHandle fragment, BleConnection *from_connection, uint64_t from_peer_id);
+
+    void expireFragmentGroups();
 
     void addAvailablePeer(const bd_addr_t &bt_address, bd_addr_type_t bt_address_type,
                           service_uuid_check_status services, int8_t rssi);
@@ -50,8 +152,11 @@ public:
 
     void printStats();
 
+    //false if the packet, or any fragment of it, did not make it onto the link's queue
     bool SendPacketToConnection(const PacketBase &packet, BleConnection &ble_connection);
 
+    bool requestSend(BleConnection &ble_connection);
+
     void sendPackets();
 
     void possiblyUpdateTimeOffset(uint64_t timestamp_ms);
@@ -66,14 +171,43 @@ public:
 
     [[nodiscard]] size_t getTargetedPacketsToSendSize() const;
 
+    [[nodiscard]] size_t getQueuedFrameBytes() const;
+
+    [[nodiscard]] size_t getIncompleteFragmentBytes() const;
+
+    [[nodiscard]] size_t getFragmentGroupsCount() const;
+
+    [[nodiscard]] uint32_t getFragmentGroupsOversize() const;
+
+    [[nodiscard]] uint32_t getFragmentGroupsIncomplete() const;
+
     PacketBase *getAnyPacket();
 
+    //queued or sent entries dropped because the packet they referred to had already gone
+    [[nodiscard]] uint32_t getStaleHandles() const;
+
+    //lets go of whatever has fallen due, looking at no more than budget entries
+    void advanceExpiry(uint32_t budget);
+
+    //everything that has fallen due, however long it takes
     void cleanupStaleItems();
 
+    [[nodiscard]] const ExpiredCounts &getExpired() const;
+
+    //recounts the bytes each store holds, between measures stored packets are charged as they come in
+    void measureMemory();
+
+    //evicts a few of the least useful packets and neighbours while any budget is under pressure
+    void relieveMemoryPressure();
+
+    //budgets can be changed at any time, they are checked against on the next pass
+    MemoryBudget &getMemoryBudget();
+
     [[nodiscard]] size_t getConnectionsCount() const;
 
-    void setConnectionHandleForPeer(uint16_t con_handle, Peer *peer);
+    void setConnectionHandleForPeer(uint16_t con_handle, uint64_t peer_id);
 
+    //nullptr if no peer announced itself on the connection or it has since been let go
     Peer *peerWithConnectionHandle(uint16_t con_handle);
 
     BleConnection *getConnectionForAddress(const uint8_t * address);
@@ -82,30 +216,113 @@ public:
 
     void writeRawPacket(hci_con_handle_t con_handle);
 
+    void reportPacketsCompleted(hci_con_handle_t con_handle, uint16_t count);
+
+    [[nodiscard]] float getPacketsPerConnectionEvent() const;
+
+    [[nodiscard]] const TxWaitStats &getTxWaitStats(TxClass tx_class) const;
+
+    [[nodiscard]] const TxDropCounts &getTxDrops() const;
+
+    InboundRing &getInboundRing();
+
+    //a write to the bitchat characteristic, queued straight away or collected until a long write is executed
+    uint8_t receiveWrite(hci_con_handle_t con_handle, uint16_t transaction_mode, uint16_t offset,
+                         const uint8_t *buffer, uint16_t buffer_size);
+
     hci_con_handle_t getAnyDuplicateHandle();
 
+    uint8_t connectionSlot(BleConnection &connection);
+
 private:
-    //Store of peer data
+    void releaseConnectionSlot(BleConnection &connection);
+
+    //the connection for the handle, scheduled for expiry when it is first seen
+    BleConnection &trackedConnection(hci_con_handle_t connection_handle);
+
+    bool scheduleExpiry(ExpiryKind kind, uint64_t key, uint64_t due_ms);
+
+    void expire(const ExpiryEntry &entry, uint64_t now_ms);
+
+    //drops the queued and sent entries of a packet that is going away
+    void forgetHandle(PacketHandle handle);
+
+    //true once every connection in use has had the packet
+    [[nodiscard]] bool isFullyDelivered(const PacketBase &packet) const;
+
+    //takes a stored packet out with its queued and sent entries, giving its bytes back to the store's budget
+    void dropPacket(PacketHandle handle, MemoryStore store);
+
+    void evictPacket(PacketHandle handle, MemoryStore store);
+
+    //hard pressure on any of the stores, once an eviction pass has had the chance to bring them down
+    bool isOverBudget(std::span<const MemoryStore> stores);
+
+    //the one seen longest ago, a peer that is heard from again is simply added back
+    void evictLeastRecentPeer();
+
+    //a fragment held while the rest of its group arrives, evicting it would lose the whole group
+    [[nodiscard]] bool isPendingFragment(const PacketBase &packet) const;
+
+    template<typename SendFrame>
+    void sendBurst(BleConnection &connection, SendFrame send_frame);
+
+    //Store of peer data, at most max_peers of them
     std::map<uint64_t, Peer> peers{};
-    //Store of message data
-    std::map<std::string, Message> messages{};
-    //Store of pass along packets
-    std::map<std::size_t, PacketPassAlong> packets{};
+    uint32_t peer_evictions{};
+    //Store of message data, keyed by a hash of the message id
+    PacketPool<Message, max_stored_messages, packet_pool_messages> messages{};
+    //Store of pass along packets, keyed by PacketPassAlong::getPacketHash
+    PacketPool<PacketPassAlong, max_stored_packets, packet_pool_pass_along> packets{};
+    uint32_t stale_handles{};
+    //Fragments held back until their whole group has arrived, keyed by the fragment id in their payload
+    std::map<uint64_t, FragmentGroup> fragment_groups{};
+    //payload bytes held in groups that are still missing fragments
+    size_t incomplete_fragment_bytes{};
+    uint32_t fragment_groups_expired{};
+    //groups with more fragments than the packet store holds, refused on the first one to arrive
+    uint32_t fragment_groups_oversize{};
+    //groups whose fragments had all arrived but some had already been evicted
+    uint32_t fragment_groups_incomplete{};
+    //Packets let in by admitPacket, keyed by PacketView::admissionKey
+    std::map<uint64_t, AdmittedPacket> admitted_packets{};
+    AdmissionRejectCounts admission_rejects{};
+    //admission keys remembered long after admitted_packets and the stores have let them go
+    SeenFilter seen_filter{};
+    //when each stored packet, admission record, connection and neighbour is next due to be looked at
+    ExpiryWheel expiry_wheel{};
+    ExpiredCounts expired{};
+    //entries the wheel had no room for
+    uint32_t expiry_overflows{};
+    MemoryBudget memory_budget{};
+    uint64_t memory_measured_ms{};
+    //messages admitted but then found malformed or too costly to store
+    MessageRejectCounts message_rejects{};
     //Store of self announcing data
     Announce announce{};
     //Store of active and disconnected connections
     std::map<hci_con_handle_t, BleConnection> connections{};
     //Store of potential connections
     std::map<std::string, BleConnection> available_neighbours{};
-    //Store of raw packets to send
-    std::multimap<hci_con_handle_t, std::vector<uint8_t>> raw_packet_to_notify{};
-    std::multimap<hci_con_handle_t, std::vector<uint8_t>> raw_packet_to_write{};
 
     uint64_t timestamp_offset_ms{};
 
-    std::map<hci_con_handle_t, Peer *> handle_peer_map{};
-    std::multimap<const PacketBase *, const BleConnection *> packets_connections_sent_list{};
-    std::multimap<const PacketBase *, const Peer *> packets_peers_sent_list{};
-    std::vector<const PacketBase *> broadcast_packets_to_send_list{};
-    std::multimap<const PacketBase *, BleConnection *> targeted_packets_to_send_list{};
+    uint32_t send_connection_events{};
+    uint32_t send_connection_event_frames{};
+    //time frames spent queued on a connection before btstack took them, per priority class
+    std::array<TxWaitStats, tx_class_count> tx_wait_stats{};
+    //frames dropped from connection queues to keep each within its budget, per reason
+    TxDropCounts tx_drops{};
+    //frames received in btstack callbacks waiting for the main loop to process them
+    InboundRing inbound_ring{};
+
+    //connection slots handed out, one bit per slot as in each packet's delivered mask
+    DeliveryMask connection_slots_in_use{};
+    static_assert(MAX_NR_HCI_CONNECTIONS <= sizeof(DeliveryMask) * 8);
+
+    //peer ids rather than pointers, a peer let go since is simply not found
+    std::map<hci_con_handle_t, uint64_t> handle_peer_map{};
+    std::multimap<PacketHandle, uint64_t> packets_peers_sent_list{};
+    std::vector<PacketHandle> broadcast_packets_to_send_list{};
+    std::multimap<PacketHandle, BleConnection *> targeted_packets_to_send_list{};
 };
@@ -0,0 +1,49 @@
+#include "ExpiryWheel.h"
+
+#include <algorithm>
+
+static_assert(expiry_wheel_capacity < 0xffff);
+
+ExpiryWheel::ExpiryWheel() {
+    heads.fill(no_entry);
+    for (uint16_t i = 0; i < expiry_wheel_capacity; i++) {
+        nodes[i].next = i + 1 < expiry_wheel_capacity ? i + 1 : no_entry;
+    }
+}
+
+bool ExpiryWheel::schedule(const uint8_t kind, const uint64_t key, const uint64_t due_ms) {
+    if (free_head == no_entry) {
+        return false;
+    }
+    const auto index = free_head;
+    auto &node = nodes[index];
+    free_head = node.next;
+    used++;
+    //rounded up, so an entry is never looked at before it is due
+    node.entry = {key, kind};
+    node.due_tick = static_cast<uint32_t>((due_ms + expiry_wheel_tick_ms - 1) / expiry_wheel_tick_ms);
+    const auto slot = std::max(node.due_tick, cursor) % expiry_wheel_slots;
+    node.next = heads[slot];
+    heads[slot] = index;
+    if (slot == cursor % expiry_wheel_slots) {
+        previous = no_entry; //went in ahead of where the slot was got to, so start it again
+    }
+    return true;
+}
+
+uint16_t ExpiryWheel::size() const {
+    return used;
+}
+
+void ExpiryWheel::catchUp(const uint32_t now_tick) {
+    if (now_tick >= cursor + expiry_wheel_slots) {
+        cursor = now_tick - (expiry_wheel_slots - 1);
+        previous = no_entry;
+    }
+}
+
+void ExpiryWheel::release(const uint16_t index) {
+    nodes[index].next = free_head;
+    free_head = index;
+    used--;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+//One slot per tick, the whole wheel spans a little more than the ten minutes items are kept so most entries are
+//looked at once, when they fall due. An item goes up to a tick late, never early
+constexpr uint32_t expiry_wheel_tick_ms = 5000;
+constexpr uint16_t expiry_wheel_slots = 128;
+//Entries set aside up front, scheduling never allocates
+constexpr uint16_t expiry_wheel_capacity = 1024;
+
+//An item due to be looked at again, what the key means is up to whoever scheduled it
+struct ExpiryEntry {
+    uint64_t key = 0;
+    uint8_t kind = 0;
+};
+
+//Hashed timing wheel, entries are chained into the slot of the tick they fall due in. advance walks the slots up to
+//now a bounded number of entries at a time, so expiry is spread over the main loop rather than done in one sweep
+class ExpiryWheel {
+public:
+    ExpiryWheel();
+
+    ExpiryWheel(const ExpiryWheel &) = delete;
+
+    ExpiryWheel &operator=(const ExpiryWheel &) = delete;
+
+    //false if every entry is in use. One already due goes in the slot being worked on for the next advance
+    bool schedule(uint8_t kind, uint64_t key, uint64_t due_ms);
+
+    //hands each entry due by now to expire, looking at no more than budget entries, returns how many were due
+    template<typename Expire>
+    uint32_t advance(const uint64_t now_ms, uint32_t budget, Expire expire) {
+        const auto now_tick = static_cast<uint32_t>(now_ms / expiry_wheel_tick_ms);
+        catchUp(now_tick);
+        uint32_t expired = 0;
+        while (budget > 0) {
+            auto &link = previous == no_entry ? heads[cursor % expiry_wheel_slots] : nodes[previous].next;
+            const auto index = link;
+            if (index == no_entry) {
+                if (cursor >= now_tick) {
+                    break;
+                }
+                cursor++;
+                previous = no_entry;
+                continue;
+            }
+            budget--;
+            if (nodes[index].due_tick > now_tick) {
+                previous = index; //a later time round the wheel
+                continue;
+            }
+            link = nodes[index].next;
+            const auto entry = nodes[index].entry;
+            release(index);
+            expired++;
+            //may schedule again, which is why the entry is released first
+            expire(entry);
+        }
+        return expired;
+    }
+
+    [[nodiscard]] uint16_t size() const;
+
+private:
+    static constexpr uint16_t no_entry = 0xffff;
+
+    struct Node {
+        ExpiryEntry entry{};
+        uint32_t due_tick = 0;
+        uint16_t next = no_entry;
+    };
+
+    //after a quiet spell the ticks further back than one turn land on slots that are visited anyway
+    void catchUp(uint32_t now_tick);
+
+    void release(uint16_t index);
+
+    std::array<Node, expiry_wheel_capacity> nodes{};
+    std::array<uint16_t, expiry_wheel_slots> heads{};
+    uint16_t free_head = 0;
+    uint16_t used = 0;
+    //tick being worked on and the last entry in its slot that was not yet due
+    uint32_t cursor = 0;
+    uint16_t previous = no_entry;
+};
@@ -0,0 +1,122 @@
+#include "InboundRing.h"
+
+#include <cstring>
+
+constexpr uint16_t record_header_size = 4;
+constexpr uint16_t wrap_marker = 0xffff;
+
+static uint32_t recordSize(const uint16_t size) {
+    return (record_header_size + size + 3) & ~3u;
+}
+
+bool InboundRing::push(const hci_con_handle_t con_handle, const uint8_t *data, const uint16_t size) {
+    const auto record = recordSize(size);
+    const auto current_head = head.load(std::memory_order_relaxed);
+    const auto current_tail = tail.load(std::memory_order_acquire);
+    //a gap of one header is always left so a full ring can't look empty
+    uint32_t position = current_head;
+    if (size > inbound_max_frame_size) {
+        position = inbound_ring_bytes;
+    } else if (current_head >= current_tail) {
+        const auto room_at_end = inbound_ring_bytes - current_head - (current_tail == 0 ? record_header_size : 0);
+        if (record > room_at_end) {
+            position = current_tail > record_header_size && record <= current_tail - record_header_size
+                           ? 0
+                           : inbound_ring_bytes;
+        }
+    } else if (record > current_tail - current_head - record_header_size) {
+        position = inbound_ring_bytes;
+    }
+    if (position == inbound_ring_bytes) {
+        overflow_drops++;
+        return false;
+    }
+    if (position != current_head) {
+        const uint16_t marker[2] = {0, wrap_marker};
+        memcpy(&buffer[current_head], marker, record_header_size);
+    }
+    const uint16_t header[2] = {con_handle, size};
+    memcpy(&buffer[position], header, record_header_size);
+    memcpy(&buffer[position + record_header_size], data, size);
+    head.store((position + record) % inbound_ring_bytes, std::memory_order_release);
+    const auto count = pushed.load(std::memory_order_relaxed) + 1;
+    pushed.store(count, std::memory_order_relaxed);
+    if (const auto depth = count - popped.load(std::memory_order_relaxed); depth > high_water) {
+        high_water = depth;
+    }
+    return true;
+}
+
+uint32_t InboundRing::oldestRecord() const {
+    const auto position = tail.load(std::memory_order_relaxed);
+    uint16_t header[2];
+    memcpy(header, &buffer[position], record_header_size);
+    return header[1] == wrap_marker ? 0 : position;
+}
+
+bool InboundRing::front(InboundFrame &frame) const {
+    if (empty()) {
+        return false;
+    }
+    const auto position = oldestRecord();
+    uint16_t header[2];
+    memcpy(header, &buffer[position], record_header_size);
+    frame.con_handle = header[0];
+    frame.size = header[1];
+    frame.data = &buffer[position + record_header_size];
+    return true;
+}
+
+void InboundRing::pop() {
+    if (empty()) {
+        return;
+    }
+    const auto position = oldestRecord();
+    uint16_t header[2];
+    memcpy(header, &buffer[position], record_header_size);
+    tail.store((position + recordSize(header[1])) % inbound_ring_bytes, std::memory_order_release);
+    popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+uint32_t InboundRing::discard(const hci_con_handle_t con_handle) {
+    //only push moves head, so the records up to it stay put while they are walked, the reader can only take some
+    const auto current_head = head.load(std::memory_order_relaxed);
+    auto position = tail.load(std::memory_order_acquire);
+    uint32_t marked = 0;
+    while (position != current_head) {
+        uint16_t header[2];
+        memcpy(header, &buffer[position], record_header_size);
+        if (header[1] == wrap_marker) {
+            position = 0;
+            continue;
+        }
+        if (header[0] == con_handle) {
+            constexpr uint16_t discarded_handle = inbound_discarded_handle;
+            memcpy(&buffer[position], &discarded_handle, sizeof(discarded_handle));
+            marked++;
+        }
+        position = (position + recordSize(header[1])) % inbound_ring_bytes;
+    }
+    discarded += marked;
+    return marked;
+}
+
+bool InboundRing::empty() const {
+    return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+}
+
+uint32_t InboundRing::getDepth() const {
+    return pushed.load(std::memory_order_relaxed) - popped.load(std::memory_order_relaxed);
+}
+
+uint32_t InboundRing::getHighWater() const {
+    return high_water;
+}
+
+uint32_t InboundRing::getOverflowDrops() const {
+    return overflow_drops;
+}
+
+uint32_t InboundRing::getDiscarded() const {
+    return discarded;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "BleConnection.h"
+
+//Largest frame queued, a long write put back together can be bigger than any single write or notification
+constexpr uint16_t inbound_max_frame_size = std::max(HCI_HOST_ACL_PACKET_LEN - 4 - 3, +max_prepared_write_size);
+//Every host acl buffer refilled four times over at the largest frame size, small frames pack in far more
+constexpr uint32_t inbound_ring_bytes = (4 * HCI_HOST_ACL_PACKET_NUM * HCI_HOST_ACL_PACKET_LEN + 3) & ~3u;
+//Bytes of frames the main loop processes before getting back to sending and housekeeping
+constexpr uint32_t inbound_drain_budget_bytes = 2048;
+//Handles are 12 bits on the air, a record given this one belonged to a connection that has since gone
+constexpr hci_con_handle_t inbound_discarded_handle = 0xffff;
+
+struct InboundFrame {
+    hci_con_handle_t con_handle = 0;
+    const uint8_t *data = nullptr;
+    uint16_t size = 0;
+};
+
+//Frames copied out of the btstack callbacks to be processed later from the main loop. There is one writer, the
+//callbacks, and one reader, the main loop, so each position is only ever stored from one side and no lock is needed
+class InboundRing {
+public:
+    //false, and counted as an overflow, if there isn't room for the frame
+    bool push(hci_con_handle_t con_handle, const uint8_t *data, uint16_t size);
+
+    //oldest frame, its data stays valid until it is popped
+    bool front(InboundFrame &frame) const;
+
+    void pop();
+
+    //called from the same side as push, the frames still queued for a connection that went away are marked so the
+    //reader throws them out rather than handing them to whatever connection gets the handle next
+    uint32_t discard(hci_con_handle_t con_handle);
+
+    [[nodiscard]] bool empty() const;
+
+    [[nodiscard]] uint32_t getDepth() const;
+
+    [[nodiscard]] uint32_t getHighWater() const;
+
+    [[nodiscard]] uint32_t getOverflowDrops() const;
+
+    [[nodiscard]] uint32_t getDiscarded() const;
+
+private:
+    //start of the oldest record, stepping over the marker left where a record didn't fit before the end
+    [[nodiscard]] uint32_t oldestRecord() const;
+
+    //each record is the connection handle and size then the frame, padded to a multiple of 4
+    alignas(4) std::array<uint8_t, inbound_ring_bytes> buffer{};
+    std::atomic<uint32_t> head{}; //stored by push only
+    std::atomic<uint32_t> tail{}; //stored by pop only
+    std::atomic<uint32_t> pushed{};
+    std::atomic<uint32_t> popped{};
+    uint32_t high_water = 0;
+    uint32_t overflow_drops = 0;
+    uint32_t discarded = 0;
+};
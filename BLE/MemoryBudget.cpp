@@ -0,0 +1,94 @@
+#include "MemoryBudget.h"
+
+#include <algorithm>
+#include <limits>
+
+void MemoryBudget::setBudget(const MemoryStore store, const uint32_t bytes) {
+    budgets[store] = bytes;
+}
+
+void MemoryBudget::setTotalBudget(const uint32_t bytes) {
+    total_budget = bytes;
+}
+
+void MemoryBudget::setUsed(const MemoryStore store, const size_t bytes) {
+    used[store] = static_cast<uint32_t>(std::min<size_t>(bytes, std::numeric_limits<uint32_t>::max()));
+}
+
+void MemoryBudget::charge(const MemoryStore store, const size_t bytes) {
+    setUsed(store, used[store] + bytes);
+}
+
+void MemoryBudget::release(const MemoryStore store, const size_t bytes) {
+    used[store] -= std::min<size_t>(bytes, used[store]);
+}
+
+MemoryPressure MemoryBudget::getPressure() const {
+    auto pressure = getTotalPressure();
+    for (uint8_t store = 0; store < memory_store_count; store++) {
+        pressure = std::max(pressure, getPressure(static_cast<MemoryStore>(store)));
+    }
+    return pressure;
+}
+
+MemoryPressure MemoryBudget::getPressure(const MemoryStore store) const {
+    return pressureOf(used[store], budgets[store]);
+}
+
+MemoryPressure MemoryBudget::getTotalPressure() const {
+    return pressureOf(getTotalUsed(), total_budget);
+}
+
+uint32_t MemoryBudget::getUsed(const MemoryStore store) const {
+    return used[store];
+}
+
+uint32_t MemoryBudget::getBudget(const MemoryStore store) const {
+    return budgets[store];
+}
+
+uint32_t MemoryBudget::getTotalUsed() const {
+    uint32_t total = 0;
+    for (const auto bytes: used) {
+        total += bytes;
+    }
+    return total;
+}
+
+uint32_t MemoryBudget::getTotalBudget() const {
+    return total_budget;
+}
+
+void MemoryBudget::countEviction(const MemoryStore store) {
+    evictions[store]++;
+}
+
+uint32_t MemoryBudget::getEvictions(const MemoryStore store) const {
+    return evictions[store];
+}
+
+void MemoryBudget::countRefusal() {
+    refusals++;
+}
+
+uint32_t MemoryBudget::getRefusals() const {
+    return refusals;
+}
+
+const char *MemoryBudget::pressureName(const MemoryPressure pressure) {
+    switch (pressure) {
+        case memory_pressure_soft:
+            return "soft";
+        case memory_pressure_hard:
+            return "hard";
+        default:
+            return "none";
+    }
+}
+
+MemoryPressure MemoryBudget::pressureOf(const uint32_t used, const uint32_t budget) {
+    if (used >= budget) {
+        return memory_pressure_hard;
+    }
+    return used >= budget / 4 * 3 ? memory_pressure_soft : memory_pressure_none;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//The stores that grow with traffic, each measured in the heap bytes it holds
+enum MemoryStore : uint8_t {
+    memory_store_messages = 0,
+    memory_store_packets,
+    memory_store_peers,
+    memory_store_tx_lists, //queued and sent lists of packet handles
+    memory_store_neighbours,
+    memory_store_connections, //links and the tx slots they hold while connected
+    memory_store_count
+};
+
+enum MemoryPressure : uint8_t {
+    memory_pressure_none = 0,
+    memory_pressure_soft, //past three quarters of a budget, the oldest and least useful packets are evicted
+    memory_pressure_hard, //past a budget, no new packets are admitted until something has been let go
+};
+
+//Default budgets, the total is less than the stores' sum so a flood into one still leaves the heap some room
+constexpr std::array<uint32_t, memory_store_count> memory_store_budgets = {
+    24 * 1024, 48 * 1024, 16 * 1024, 8 * 1024, 16 * 1024, 16 * 1024
+};
+constexpr uint32_t memory_total_budget = 96 * 1024;
+//How often the stores are measured again, packets stored in between are charged as they arrive
+constexpr uint32_t memory_measure_interval_ms = 1000;
+//Rough cost of a node in a std::map or multimap on top of the entry it holds
+constexpr size_t memory_map_node_bytes = 4 * sizeof(void *);
+
+//Bytes held in each store against its budget and against the total, and what was done to stay within them
+class MemoryBudget {
+public:
+    void setBudget(MemoryStore store, uint32_t bytes);
+
+    void setTotalBudget(uint32_t bytes);
+
+    //what the store was found to hold when last measured
+    void setUsed(MemoryStore store, size_t bytes);
+
+    //held since the last measure, until the next one replaces it
+    void charge(MemoryStore store, size_t bytes);
+
+    //let go of since the last measure
+    void release(MemoryStore store, size_t bytes);
+
+    //worst of the stores and the total
+    [[nodiscard]] MemoryPressure getPressure() const;
+
+    [[nodiscard]] MemoryPressure getPressure(MemoryStore store) const;
+
+    [[nodiscard]] MemoryPressure getTotalPressure() const;
+
+    [[nodiscard]] uint32_t getUsed(MemoryStore store) const;
+
+    [[nodiscard]] uint32_t getBudget(MemoryStore store) const;
+
+    [[nodiscard]] uint32_t getTotalUsed() const;
+
+    [[nodiscard]] uint32_t getTotalBudget() const;
+
+    void countEviction(MemoryStore store);
+
+    [[nodiscard]] uint32_t getEvictions(MemoryStore store) const;
+
+    void countRefusal();
+
+    //packets and neighbours turned away under hard pressure
+    [[nodiscard]] uint32_t getRefusals() const;
+
+    [[nodiscard]] static const char *pressureName(MemoryPressure pressure);
+
+private:
+    [[nodiscard]] static MemoryPressure pressureOf(uint32_t used, uint32_t budget);
+
+    std::array<uint32_t, memory_store_count> budgets = memory_store_budgets;
+    uint32_t total_budget = memory_total_budget;
+    std::array<uint32_t, memory_store_count> used{};
+    std::array<uint32_t, memory_store_count> evictions{};
+    uint32_t refusals = 0;
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+//Reference to a pooled packet: the slot, which pool it is in and the slot's generation when it was handed out. A
+//slot that has since been freed or reused has moved on a generation, so the handle no longer resolves
+class PacketHandle {
+public:
+    static constexpr uint16_t max_index = 0x3fff;
+
+    constexpr PacketHandle() = default;
+
+    constexpr PacketHandle(const uint8_t pool, const uint16_t index, const uint16_t generation)
+        : value(static_cast<uint32_t>(generation) << 16 | (pool & 3u) << 14 | (index & max_index)) {
+    }
+
+    //back from getValue, for keeping a handle where only a plain integer fits
+    explicit constexpr PacketHandle(const uint32_t value) : value(value) {
+    }
+
+    [[nodiscard]] constexpr uint8_t getPool() const {
+        return value >> 14 & 3;
+    }
+
+    [[nodiscard]] constexpr uint16_t getIndex() const {
+        return value & max_index;
+    }
+
+    [[nodiscard]] constexpr uint16_t getGeneration() const {
+        return value >> 16;
+    }
+
+    [[nodiscard]] constexpr uint32_t getValue() const {
+        return value;
+    }
+
+    //generations start at one, so only a default constructed handle is false
+    explicit constexpr operator bool() const {
+        return value != 0;
+    }
+
+    constexpr auto operator<=>(const PacketHandle &) const = default;
+
+private:
+    uint32_t value = 0;
+};
+
+//Fixed number of packet slots set aside up front, each found again by a 64 bit key. When every slot is taken the
+//packet with the oldest timestamp, or the lowest by the rank insert is given, is evicted, anything still holding its
+//handle finds it gone rather than dangling
+template<typename Packet, uint16_t Capacity, uint8_t Pool>
+class PacketPool {
+    static_assert(Capacity > 0 && Capacity <= PacketHandle::max_index);
+
+public:
+    PacketPool() {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            free_slots[i] = Capacity - 1 - i;
+        }
+    }
+
+    PacketPool(const PacketPool &) = delete;
+
+    PacketPool &operator=(const PacketPool &) = delete;
+
+    PacketHandle insert(const uint64_t key, Packet &&packet) {
+        return insert(key, std::move(packet), [](const Packet &stored) {
+            return stored.getPacketTimestamp();
+        });
+    }
+
+    //when every slot is taken the packet ranking lowest makes room
+    template<typename Rank>
+    PacketHandle insert(const uint64_t key, Packet &&packet, Rank rank) {
+        if (free_count == 0) {
+            release(lowest(rank).getIndex());
+            evictions++;
+        }
+        const auto index = free_slots[--free_count];
+        auto &slot = slots[index];
+        slot.packet.emplace(std::move(packet));
+        keys[index] = key;
+        return {Pool, index, slot.generation};
+    }
+
+    [[nodiscard]] Packet *get(const PacketHandle handle) {
+        const auto index = liveIndex(handle);
+        return index < Capacity ? &*slots[index].packet : nullptr;
+    }
+
+    [[nodiscard]] const Packet *get(const PacketHandle handle) const {
+        const auto index = liveIndex(handle);
+        return index < Capacity ? &*slots[index].packet : nullptr;
+    }
+
+    //first live slot stored under the key and accepted by match, an empty handle if there is none
+    template<typename Match>
+    [[nodiscard]] PacketHandle find(const uint64_t key, Match match) const {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (keys[i] == key && slots[i].packet && match(*slots[i].packet)) {
+                return {Pool, i, slots[i].generation};
+            }
+        }
+        return {};
+    }
+
+    [[nodiscard]] PacketHandle find(const uint64_t key) const {
+        return find(key, [](const Packet &) {
+            return true;
+        });
+    }
+
+    void erase(const PacketHandle handle) {
+        if (const auto index = liveIndex(handle); index < Capacity) {
+            release(index);
+        }
+    }
+
+    template<typename Stale>
+    size_t eraseIf(Stale stale) {
+        size_t erased = 0;
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (slots[i].packet && stale(*slots[i].packet)) {
+                release(i);
+                erased++;
+            }
+        }
+        return erased;
+    }
+
+    template<typename Visit>
+    void forEach(Visit visit) {
+        for (auto &slot: slots) {
+            if (slot.packet) {
+                visit(*slot.packet);
+            }
+        }
+    }
+
+    template<typename Visit>
+    void forEach(Visit visit) const {
+        for (const auto &slot: slots) {
+            if (slot.packet) {
+                visit(*slot.packet);
+            }
+        }
+    }
+
+    //live slot whose packet ranks lowest, an empty handle if the pool is empty
+    template<typename Rank>
+    [[nodiscard]] PacketHandle lowest(Rank rank) const {
+        uint16_t found = Capacity;
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (slots[i].packet && (found == Capacity || rank(*slots[i].packet) < rank(*slots[found].packet))) {
+                found = i;
+            }
+        }
+        return found < Capacity ? PacketHandle{Pool, found, slots[found].generation} : PacketHandle{};
+    }
+
+    [[nodiscard]] PacketHandle first() const {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (slots[i].packet) {
+                return {Pool, i, slots[i].generation};
+            }
+        }
+        return {};
+    }
+
+    [[nodiscard]] uint16_t size() const {
+        return Capacity - free_count;
+    }
+
+    [[nodiscard]] static constexpr uint16_t capacity() {
+        return Capacity;
+    }
+
+    [[nodiscard]] uint32_t getEvictions() const {
+        return evictions;
+    }
+
+private:
+    struct Slot {
+        std::optional<Packet> packet{};
+        uint16_t generation = 1;
+    };
+
+    //the slot the handle still refers to, or Capacity if it is from another pool or the slot has moved on
+    [[nodiscard]] uint16_t liveIndex(const PacketHandle handle) const {
+        const auto index = handle.getIndex();
+        if (handle.getPool() != Pool || index >= Capacity || !slots[index].packet ||
+            slots[index].generation != handle.getGeneration()) {
+            return Capacity;
+        }
+        return index;
+    }
+
+    void release(const uint16_t index) {
+        auto &slot = slots[index];
+        slot.packet.reset();
+        //zero is left out so a live handle is never mistaken for an empty one
+        slot.generation = slot.generation == 0xffff ? 1 : slot.generation + 1;
+        free_slots[free_count++] = index;
+    }
+
+    std::array<Slot, Capacity> slots{};
+    //kept apart from the slots so a lookup runs over one small array
+    std::array<uint64_t, Capacity> keys{};
+    std::array<uint16_t, Capacity> free_slots{};
+    uint16_t free_count = Capacity;
+    uint32_t evictions = 0;
+};
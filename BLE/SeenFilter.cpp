@@ -0,0 +1,90 @@
+#include "SeenFilter.h"
+
+#include <cmath>
+
+static_assert((seen_filter_bits & (seen_filter_bits - 1)) == 0);
+
+//double hashing, the probes are spread by the high half of the key stepping from the low half
+template<typename Probe>
+static bool forEachProbe(const uint64_t key, Probe probe) {
+    const auto first = static_cast<uint32_t>(key);
+    const auto step = static_cast<uint32_t>(key >> 32) | 1;
+    for (uint8_t i = 0; i < seen_filter_probes; i++) {
+        if (!probe((first + i * step) & (seen_filter_bits - 1))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SeenFilter::insert(const uint64_t key, const uint64_t now_ms) {
+    expire(now_ms);
+    auto &generation = generations[current];
+    forEachProbe(key, [&generation](const uint32_t bit) {
+        auto &word = generation.bits[bit / 32];
+        const uint32_t mask = 1u << bit % 32;
+        if (!(word & mask)) {
+            word |= mask;
+            generation.bits_set++;
+        }
+        return true;
+    });
+    generation.keys++;
+}
+
+bool SeenFilter::contains(const uint64_t key) const {
+    for (const auto &generation: generations) {
+        if (generation.keys > 0 && forEachProbe(key, [&generation](const uint32_t bit) {
+            return (generation.bits[bit / 32] & 1u << bit % 32) != 0;
+        })) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SeenFilter::expire(const uint64_t now_ms) {
+    //a quiet spell can leave generations behind that are older than the whole window
+    for (auto &generation: generations) {
+        if (generation.keys > 0 &&
+            generation.started_ms + seen_filter_generation_ms * seen_filter_generations <= now_ms) {
+            generation = {};
+        }
+    }
+    auto &newest = generations[current];
+    if (newest.keys == 0) {
+        newest.started_ms = now_ms;
+        return;
+    }
+    if (newest.started_ms + seen_filter_generation_ms > now_ms && newest.keys < seen_filter_capacity) {
+        return;
+    }
+    current = (current + 1) % seen_filter_generations;
+    generations[current] = {};
+    generations[current].started_ms = now_ms;
+}
+
+uint32_t SeenFilter::getKeys() const {
+    uint32_t keys = 0;
+    for (const auto &generation: generations) {
+        keys += generation.keys;
+    }
+    return keys;
+}
+
+float SeenFilter::getFill() const {
+    uint32_t bits_set = 0;
+    for (const auto &generation: generations) {
+        bits_set += generation.bits_set;
+    }
+    return static_cast<float>(bits_set) / (seen_filter_bits * seen_filter_generations);
+}
+
+float SeenFilter::getFalsePositiveRate() const {
+    float missed_everywhere = 1;
+    for (const auto &generation: generations) {
+        const float fill = static_cast<float>(generation.bits_set) / seen_filter_bits;
+        missed_everywhere *= 1 - std::pow(fill, seen_filter_probes);
+    }
+    return 1 - missed_everywhere;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+//Keys go into the newest generation and the oldest is cleared to make room, so a key is remembered for at least
+//three generations, longer than any packet is kept
+constexpr uint8_t seen_filter_generations = 4;
+constexpr uint32_t seen_filter_generation_ms = 15 * 60 * 1000;
+//Bits per generation, 16 per key at capacity, past which the generation is retired early rather than let its
+//false positive rate climb. A full generation wrongly matches about one key in 1700
+constexpr uint32_t seen_filter_bits = 32 * 1024;
+constexpr uint16_t seen_filter_capacity = seen_filter_bits / 16;
+constexpr uint8_t seen_filter_probes = 8;
+
+//Dedup keys of packets already seen, in a fixed 16KB whatever the traffic. A time partitioned bloom filter, a key
+//still in a live generation is always found, one never inserted is wrongly found at about the rate reported
+class SeenFilter {
+public:
+    void insert(uint64_t key, uint64_t now_ms);
+
+    [[nodiscard]] bool contains(uint64_t key) const;
+
+    //starts a new generation once the current one is old or full, clearing the oldest
+    void expire(uint64_t now_ms);
+
+    [[nodiscard]] uint32_t getKeys() const;
+
+    //fraction of the bits set across the live generations
+    [[nodiscard]] float getFill() const;
+
+    //chance a key never inserted is reported as seen, estimated from how full each generation is
+    [[nodiscard]] float getFalsePositiveRate() const;
+
+private:
+    struct Generation {
+        std::array<uint32_t, seen_filter_bits / 32> bits{};
+        uint64_t started_ms = 0;
+        uint16_t keys = 0;
+        uint16_t bits_set = 0;
+    };
+
+    std::array<Generation, seen_filter_generations> generations{};
+    uint8_t current = 0;
+};
@@ -0,0 +1,240 @@
+#include "TxQueue.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "../Bitchat/BitchatPacketTypes.h"
+
+TxClass txClassForPacketType(const uint8_t packet_type) {
+    switch (packet_type) {
+        case type_announce:
+        case type_leave:
+        case deliveryAck:
+        case readReceipt:
+        case noiseHandshakeInit:
+        case noiseHandshakeResp:
+        case noiseIdentityAnnounce:
+            return tx_class_control;
+        case type_fragment_start:
+        case fragmentContinue:
+        case fragmentEnd:
+        case noiseEncrypted:
+            return tx_class_bulk;
+        default:
+            return tx_class_normal;
+    }
+}
+
+void TxWaitStats::record(const uint64_t wait_us) {
+    count++;
+    total_us += wait_us;
+    max_us = std::max(max_us, wait_us);
+}
+
+uint64_t TxWaitStats::averageUs() const {
+    return count ? total_us / count : 0;
+}
+
+TxQueue::TxQueue(const TxQueue &other) {
+    *this = other;
+}
+
+TxQueue &TxQueue::operator=(const TxQueue &other) {
+    if (this != &other) {
+        slots = other.slots ? std::make_unique<Slots>(*other.slots) : nullptr;
+        heads = other.heads;
+        tails = other.tails;
+        free_head = other.free_head;
+        count = other.count;
+        queued_bytes = other.queued_bytes;
+        sending_group = other.sending_group;
+        dropped_group = other.dropped_group;
+        deficit_bytes = other.deficit_bytes;
+    }
+    return *this;
+}
+
+bool TxQueue::push(EncodedFrame frame, const TxClass tx_class, const uint8_t ttl, const uint64_t now_us,
+                   TxDropCounts &drops, const uint64_t group) {
+    const auto frame_size = frame->size();
+    if (group != 0 && group == dropped_group) {
+        drops[tx_drop_fragment_group]++;
+        return false;
+    }
+    if (group != 0) {
+        dropped_group = 0; //the next group has started, what was left of the dropped one won't follow it
+    }
+    if (frame_size > tx_queue_max_bytes) {
+        drops[tx_drop_oversize]++;
+        eraseGroup(group, tx_drop_fragment_group, drops);
+        return false;
+    }
+    //worse is a lower priority class, then a lower ttl, then queued earlier
+    auto worse = [](const TxClass a_class, const uint8_t a_ttl, const TxClass b_class, const uint8_t b_ttl) {
+        return a_class != b_class ? a_class > b_class : a_ttl < b_ttl;
+    };
+    auto victim_rank = [this](const TxEntry &entry) {
+        return std::pair(entry.group != 0 && entry.group == sending_group, entry.ttl);
+    };
+    while (count >= tx_queue_max_frames || queued_bytes + frame_size > tx_queue_max_bytes) {
+        const auto reason = count >= tx_queue_max_frames ? tx_drop_frame_budget : tx_drop_byte_budget;
+        auto victim_class = static_cast<TxClass>(tx_class_count - 1);
+        while (heads[victim_class] == no_slot) {
+            victim_class = static_cast<TxClass>(victim_class - 1);
+        }
+        //first of the lowest ttl, the oldest, outside the group being sent if there is one
+        auto victim = heads[victim_class];
+        auto victim_previous = no_slot;
+        for (auto previous = victim, index = slots->next[victim]; index != no_slot;
+             previous = index, index = slots->next[index]) {
+            if (victim_rank(slots->entries[index]) < victim_rank(slots->entries[victim])) {
+                victim = index;
+                victim_previous = previous;
+            }
+        }
+        const auto &entry = slots->entries[victim];
+        if (worse(tx_class, ttl, entry.tx_class, entry.ttl) || (group != 0 && entry.group == group)) {
+            drops[reason]++; //the new frame is the least valuable one, on a tie the older frame goes
+            eraseGroup(group, tx_drop_fragment_group, drops);
+            return false;
+        }
+        if (entry.group != 0) {
+            eraseGroup(entry.group, reason, drops);
+        } else {
+            erase(victim_class, victim_previous, victim);
+            drops[reason]++;
+        }
+    }
+    if (!slots) {
+        slots = std::make_unique<Slots>();
+        for (uint8_t index = 0; index < tx_queue_max_frames; index++) {
+            slots->next[index] = index + 1 < tx_queue_max_frames ? index + 1 : no_slot;
+        }
+        free_head = 0;
+    }
+    const auto index = free_head;
+    free_head = slots->next[index];
+    slots->entries[index] = {std::move(frame), now_us, tx_class, ttl, group};
+    slots->next[index] = no_slot;
+    if (tails[tx_class] == no_slot) {
+        heads[tx_class] = index;
+    } else {
+        slots->next[tails[tx_class]] = index;
+    }
+    tails[tx_class] = index;
+    queued_bytes += frame_size;
+    count++;
+    return true;
+}
+
+void TxQueue::startGroup(const uint64_t group) {
+    if (group != 0 && group == dropped_group) {
+        dropped_group = 0;
+    }
+}
+
+const TxEntry *TxQueue::front() const {
+    for (const auto head: heads) {
+        if (head != no_slot) {
+            return &slots->entries[head];
+        }
+    }
+    return nullptr;
+}
+
+void TxQueue::pop() {
+    for (uint8_t tx_class = 0; tx_class < tx_class_count; tx_class++) {
+        if (const auto head = heads[tx_class]; head != no_slot) {
+            sending_group = slots->entries[head].group;
+            erase(static_cast<TxClass>(tx_class), no_slot, head);
+            return;
+        }
+    }
+}
+
+void TxQueue::clear(TxDropCounts &drops) {
+    drops[tx_drop_disconnected] += count;
+    slots.reset();
+    heads.fill(no_slot);
+    tails.fill(no_slot);
+    free_head = no_slot;
+    count = 0;
+    queued_bytes = 0;
+    deficit_bytes = 0;
+    sending_group = 0;
+    dropped_group = 0;
+}
+
+void TxQueue::erase(const TxClass tx_class, const uint8_t previous, const uint8_t index) {
+    const auto next = slots->next[index];
+    if (previous == no_slot) {
+        heads[tx_class] = next;
+    } else {
+        slots->next[previous] = next;
+    }
+    if (tails[tx_class] == index) {
+        tails[tx_class] = previous;
+    }
+    auto &entry = slots->entries[index];
+    queued_bytes -= entry.frame->size();
+    entry.frame.reset();
+    slots->next[index] = free_head;
+    free_head = index;
+    count--;
+}
+
+void TxQueue::eraseGroup(const uint64_t group, const TxDropReason reason, TxDropCounts &drops) {
+    if (group == 0) {
+        return;
+    }
+    for (uint8_t tx_class = 0; tx_class < tx_class_count; tx_class++) {
+        auto previous = no_slot;
+        for (auto index = heads[tx_class]; index != no_slot;) {
+            const auto next = slots->next[index];
+            if (slots->entries[index].group == group) {
+                erase(static_cast<TxClass>(tx_class), previous, index);
+                drops[reason]++;
+            } else {
+                previous = index;
+            }
+            index = next;
+        }
+    }
+    dropped_group = group;
+}
+
+bool TxQueue::empty() const {
+    return count == 0;
+}
+
+size_t TxQueue::size() const {
+    return count;
+}
+
+size_t TxQueue::size(const TxClass tx_class) const {
+    size_t entries = 0;
+    forEach(tx_class, [&entries](const TxEntry &) {
+        entries++;
+    });
+    return entries;
+}
+
+size_t TxQueue::getHeldBytes() const {
+    return slots ? sizeof(Slots) : 0;
+}
+
+uint32_t TxQueue::getQueuedBytes() const {
+    return queued_bytes;
+}
+
+bool TxQueue::isCongested() const {
+    return count >= tx_queue_max_frames * 3 / 4 || queued_bytes >= tx_queue_max_bytes * 3 / 4;
+}
+
+uint32_t TxQueue::getDeficit() const {
+    return deficit_bytes;
+}
+
+void TxQueue::setDeficit(const uint32_t bytes) {
+    deficit_bytes = bytes;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "../Bitchat/PacketBase.h"
+
+//Priority classes for outgoing frames, lower value is sent first
+enum TxClass : uint8_t {
+    tx_class_control = 0, //announce, handshakes and acks, small and latency sensitive
+    tx_class_normal,
+    tx_class_bulk, //encrypted transport and fragments
+    tx_class_count
+};
+
+TxClass txClassForPacketType(uint8_t packet_type);
+
+//Budget per connection, a peer that stops servicing its link can only hold this much
+constexpr uint16_t tx_queue_max_frames = 64;
+constexpr uint32_t tx_queue_max_bytes = 8 * 1024;
+
+enum TxDropReason : uint8_t {
+    tx_drop_frame_budget = 0, //evicted or refused because the queue held too many frames
+    tx_drop_byte_budget, //evicted or refused because the queue held too many bytes
+    tx_drop_oversize, //a single frame larger than the whole byte budget
+    tx_drop_disconnected, //still queued when the connection went away
+    tx_drop_fragment_group, //rest of a fragment group that had already lost a member on this queue
+    tx_drop_reason_count
+};
+
+using TxDropCounts = std::array<uint32_t, tx_drop_reason_count>;
+
+struct TxEntry {
+    EncodedFrame frame{};
+    uint64_t enqueued_us = 0;
+    TxClass tx_class = tx_class_normal;
+    uint8_t ttl = 0;
+    //fragments of one packet share a non zero group and are evicted together
+    uint64_t group = 0;
+};
+
+struct TxWaitStats {
+    uint32_t count = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+
+    void record(uint64_t wait_us);
+
+    [[nodiscard]] uint64_t averageUs() const;
+};
+
+//Frames waiting to go out on one connection, strict priority between classes and FIFO within a class. The slots are
+//set aside when the link first queues a frame and given back when it is cleared, so a neighbour that never connects
+//holds none
+class TxQueue {
+public:
+    TxQueue() = default;
+
+    TxQueue(const TxQueue &other);
+
+    TxQueue &operator=(const TxQueue &other);
+
+    TxQueue(TxQueue &&) = default;
+
+    TxQueue &operator=(TxQueue &&) = default;
+
+    //makes room by dropping the lowest class, then lowest ttl, then oldest frame, false if the new frame was dropped,
+    //a fragment group part way out on the link is kept over the others and a dropped fragment takes its group with it
+    bool push(EncodedFrame frame, TxClass tx_class, uint8_t ttl, uint64_t now_us, TxDropCounts &drops,
+              uint64_t group = 0);
+
+    //the group is about to be queued again from its first fragment, so it is no longer refused as what is left of a
+    //copy that was dropped
+    void startGroup(uint64_t group);
+
+    [[nodiscard]] const TxEntry *front() const;
+
+    void pop();
+
+    void clear(TxDropCounts &drops);
+
+    [[nodiscard]] bool empty() const;
+
+    [[nodiscard]] size_t size() const;
+
+    [[nodiscard]] size_t size(TxClass tx_class) const;
+
+    [[nodiscard]] uint32_t getQueuedBytes() const;
+
+    //past the high water mark, new frames should wait until btstack has taken some
+    [[nodiscard]] bool isCongested() const;
+
+    //oldest first
+    template<typename Visit>
+    void forEach(const TxClass tx_class, Visit visit) const {
+        for (auto index = heads[tx_class]; index != no_slot; index = slots->next[index]) {
+            visit(slots->entries[index]);
+        }
+    }
+
+    //heap set aside for the slots, none until the first frame is queued
+    [[nodiscard]] size_t getHeldBytes() const;
+
+    [[nodiscard]] uint32_t getDeficit() const;
+
+    void setDeficit(uint32_t bytes);
+
+private:
+    static constexpr uint8_t no_slot = 0xff;
+    static_assert(tx_queue_max_frames < no_slot);
+
+    //each class is a list chained through next, unused slots are chained from free_head
+    struct Slots {
+        std::array<TxEntry, tx_queue_max_frames> entries{};
+        std::array<uint8_t, tx_queue_max_frames> next{};
+    };
+
+    //unlinks index from its class list, previous is the slot before it or no_slot at the head
+    void erase(TxClass tx_class, uint8_t previous, uint8_t index);
+
+    void eraseGroup(uint64_t group, TxDropReason reason, TxDropCounts &drops);
+
+    std::unique_ptr<Slots> slots;
+    std::array<uint8_t, tx_class_count> heads{no_slot, no_slot, no_slot};
+    std::array<uint8_t, tx_class_count> tails{no_slot, no_slot, no_slot};
+    uint8_t free_head = no_slot;
+    uint8_t count = 0;
+    uint32_t queued_bytes = 0;
+    //group whose fragments have started going out, and the last one cut short so its stragglers are refused until
+    //another group is queued
+    uint64_t sending_group = 0;
+    uint64_t dropped_group = 0;
+    //deficit round robin byte allowance carried between connection events
+    uint32_t deficit_bytes = 0;
+};
@@ -8,6 +8,7 @@ Announce::Announce()
 
 void Announce::setName(std::string value) {
     name = std::move(value);
+    invalidateEncodedFrame();
 }
 
 const std::string &Announce::getName() const {
@@ -45,3 +45,14 @@ enum PacketFlag {
     packet_flag_has_signature = 0x02,
     packet_flag_is_compressed = 0x04
 };
+
+enum MessageFlag {
+    message_flag_is_relay = 0x01,
+    message_flag_is_private = 0x02,
+    message_flag_has_original_sender = 0x04,
+    message_flag_has_recipient_nickname = 0x08,
+    message_flag_has_sender_peer_id = 0x10,
+    message_flag_has_mentions = 0x20,
+    message_flag_has_channel = 0x40,
+    message_flag_is_encrypted = 0x80
+};
@@ -0,0 +1,65 @@
+#include "FragmentGroup.h"
+
+bool FragmentHeader::parse(const std::string_view payload, FragmentHeader &header) {
+    if (payload.size() < fragment_header_size) {
+        return false;
+    }
+    const auto byte = [payload](const size_t i) {
+        return static_cast<uint8_t>(payload[i]);
+    };
+    header.fragment_id = 0;
+    for (size_t i = 0; i < 8; i++) {
+        header.fragment_id = header.fragment_id << 8 | byte(i);
+    }
+    header.index = static_cast<uint16_t>(byte(8) << 8 | byte(9));
+    header.total = static_cast<uint16_t>(byte(10) << 8 | byte(11));
+    header.original_type = byte(12);
+    return header.total > 0 && header.index < header.total;
+}
+
+bool FragmentGroup::addFragment(const FragmentHeader &header, const uint64_t packet_hash, const size_t payload_size,
+                                const uint64_t now_us) {
+    if (rejected) {
+        return false;
+    }
+    if (fragments.empty()) {
+        total = header.total;
+        first_seen_us = now_us;
+    } else if (header.total != total) {
+        return false; //disagrees with the rest of the group
+    }
+    if (!fragments.emplace(header.index, packet_hash).second) {
+        return false;
+    }
+    bytes += payload_size;
+    return true;
+}
+
+void FragmentGroup::reject(const uint64_t now_us) {
+    rejected = true;
+    first_seen_us = now_us;
+}
+
+bool FragmentGroup::isRejected() const {
+    return rejected;
+}
+
+bool FragmentGroup::isComplete() const {
+    return total > 0 && fragments.size() == total;
+}
+
+uint16_t FragmentGroup::getTotal() const {
+    return total;
+}
+
+uint64_t FragmentGroup::getFirstSeenUs() const {
+    return first_seen_us;
+}
+
+size_t FragmentGroup::getBytes() const {
+    return bytes;
+}
+
+const std::map<uint16_t, uint64_t> &FragmentGroup::getFragments() const {
+    return fragments;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string_view>
+
+//Header at the start of every fragment payload, ahead of its slice of the original frame
+struct FragmentHeader {
+    uint64_t fragment_id = 0;
+    uint16_t index = 0;
+    uint16_t total = 0;
+    uint8_t original_type = 0;
+
+    static bool parse(std::string_view payload, FragmentHeader &header);
+};
+
+constexpr size_t fragment_header_size = 8 + 2 + 2 + 1;
+
+//The stored fragments of one original packet, relayed only once every one of them has arrived
+class FragmentGroup {
+public:
+    bool addFragment(const FragmentHeader &header, uint64_t packet_hash, size_t payload_size, uint64_t now_us);
+
+    //a group that will never be relayed, its fragments are refused until it expires
+    void reject(uint64_t now_us);
+
+    [[nodiscard]] bool isRejected() const;
+
+    [[nodiscard]] bool isComplete() const;
+
+    [[nodiscard]] uint16_t getTotal() const;
+
+    [[nodiscard]] uint64_t getFirstSeenUs() const;
+
+    [[nodiscard]] size_t getBytes() const;
+
+    [[nodiscard]] const std::map<uint16_t, uint64_t> &getFragments() const;
+
+private:
+    uint16_t total = 0;
+    uint64_t first_seen_us = 0;
+    size_t bytes = 0;
+    bool rejected = false;
+    //packet store keys in index order, so a complete group goes out start to end
+    std::map<uint16_t, uint64_t> fragments{};
+};
@@ -1,56 +1,104 @@
 #include "Message.h"
 
-Message::Message() : PacketBase(type_message), sender_peer(nullptr) {
+#include <algorithm>
+
+Message::Message() : PacketBase(type_message) {
 }
 
 Message::Message(const uint8_t ttl, const uint64_t timestamp, const uint8_t packet_flags, const uint64_t sender)
-    : PacketBase(type_message, ttl, timestamp, packet_flags, sender), sender_peer(nullptr) {
+    : PacketBase(type_message, ttl, timestamp, packet_flags, sender) {
 }
 
 Message::Message(const uint8_t ttl, const uint64_t timestamp, const uint8_t packet_flags, const uint64_t sender,
-                 const uint64_t recipient, const std::string &signature)
-    : PacketBase(type_message, ttl, timestamp, packet_flags, sender, recipient, signature),
-      sender_peer(nullptr) {
+                 const uint64_t recipient, const std::span<const uint8_t> signature)
+    : PacketBase(type_message, ttl, timestamp, packet_flags, sender, recipient),
+      signature_size(static_cast<uint8_t>(std::min(signature.size(), static_cast<size_t>(message_signature_size)))) {
+    std::copy_n(signature.begin(), signature_size, this->signature.begin());
 }
 
 void Message::setMessageFlags(const uint8_t flags) {
     message_flags = flags;
+    invalidateEncodedFrame();
 }
 
 void Message::setMessageTimestamp(uint64_t value) {
     message_timestamp = value;
+    invalidateEncodedFrame();
+}
+
+size_t Message::textStart(const MessageText field) const {
+    return field == 0 ? 0 : text_ends[field - 1];
+}
+
+std::string_view Message::getText(const MessageText field) const {
+    const auto start = textStart(field);
+    return {text.data() + start, text_ends[field] - start};
+}
+
+void Message::replaceText(const MessageText field, const size_t keep, const std::string_view value) {
+    const auto cut = textStart(field) + keep;
+    const size_t end = text_ends[field];
+    std::vector<char> replaced;
+    replaced.reserve(text.size() - (end - cut) + value.size());
+    replaced.insert(replaced.end(), text.begin(), text.begin() + cut);
+    replaced.insert(replaced.end(), value.begin(), value.end());
+    replaced.insert(replaced.end(), text.begin() + end, text.end());
+    text = std::move(replaced);
+    for (auto i = static_cast<size_t>(field); i < text_ends.size(); i++) {
+        text_ends[i] = static_cast<uint16_t>(text_ends[i] + value.size() - (end - cut));
+    }
+    invalidateEncodedFrame();
+}
+
+void Message::setMessageId(const std::string_view value) {
+    replaceText(message_text_id, 0, value);
 }
 
-void Message::setMessageId(const std::string &string) {
-    message_id = string;
+void Message::setSenderNickname(const std::string_view value) {
+    replaceText(message_text_sender_nickname, 0, value);
 }
 
-void Message::setSenderNickname(const std::string &string) {
-    sender_nickname = string;
+void Message::setContent(const std::string_view value) {
+    replaceText(message_text_content, 0, value);
 }
 
-void Message::setContent(const std::string &string) {
-    content = string;
+void Message::setEncryptedContent(const std::string_view value) {
+    replaceText(message_text_encrypted_content, 0, value);
 }
 
-void Message::setEncryptedContent(const std::string &string) {
-    encrypted_content = string;
+void Message::setOriginalSenderNickname(const std::string_view value) {
+    replaceText(message_text_original_sender_nickname, 0, value);
 }
 
-void Message::setOriginalSenderNickname(const std::string &string) {
-    original_sender_nickname = string;
+void Message::setRecipientNickname(const std::string_view value) {
+    replaceText(message_text_recipient_nickname, 0, value);
 }
 
-void Message::setRecipientNickname(const std::string &string) {
-    recipient_nickname = string;
+void Message::addMention(const std::string_view value) {
+    std::array<char, 256> mention;
+    const auto length = std::min(value.size(), mention.size() - 1);
+    mention[0] = static_cast<char>(length);
+    std::copy_n(value.begin(), length, mention.begin() + 1);
+    replaceText(message_text_mentions, getText(message_text_mentions).size(), {mention.data(), 1 + length});
 }
 
-void Message::addMention(const std::string &string) {
-    mentions.push_back(string);
+void Message::setChannel(const std::string_view value) {
+    replaceText(message_text_channel, 0, value);
 }
 
-void Message::setChannel(const std::string &string) {
-    channel = string;
+void Message::setTexts(const std::array<std::string_view, message_text_count> &values) {
+    size_t size = 0;
+    for (const auto value: values) {
+        size += value.size();
+    }
+    std::vector<char> block;
+    block.reserve(size);
+    for (size_t i = 0; i < values.size(); i++) {
+        block.insert(block.end(), values[i].begin(), values[i].end());
+        text_ends[i] = static_cast<uint16_t>(block.size());
+    }
+    text = std::move(block);
+    invalidateEncodedFrame();
 }
 
 uint8_t Message::getMessageFlags() const {
@@ -61,38 +109,63 @@ uint64_t Message::getMessageTimestamp() const {
     return message_timestamp;
 }
 
-const std::string &Message::getMessageId() const {
-    return message_id;
+std::string_view Message::getMessageId() const {
+    return getText(message_text_id);
+}
+
+std::string_view Message::getSenderNickname() const {
+    return getText(message_text_sender_nickname);
+}
+
+std::string_view Message::getContent() const {
+    return getText(message_text_content);
+}
+
+std::string_view Message::getEncryptedContent() const {
+    return getText(message_text_encrypted_content);
+}
+
+std::string_view Message::getOriginalSenderNickname() const {
+    return getText(message_text_original_sender_nickname);
 }
 
-const std::string &Message::getSenderNickname() const {
-    return sender_nickname;
+std::string_view Message::getRecipientNickname() const {
+    return getText(message_text_recipient_nickname);
 }
 
-const std::string &Message::getContent() const {
-    return content;
+void Message::setSenderPeerId(const uint64_t peer_id) {
+    sender_peer_id = peer_id;
+    sender_peer_id_set = true;
+    invalidateEncodedFrame();
 }
 
-const std::string &Message::getOriginalSenderNickname() const {
-    return original_sender_nickname;
+std::optional<uint64_t> Message::getSenderPeerId() const {
+    if (!sender_peer_id_set) {
+        return std::nullopt;
+    }
+    return sender_peer_id;
 }
 
-const std::string &Message::getRecipientNickname() const {
-    return recipient_nickname;
+size_t Message::getMentionCount() const {
+    size_t count = 0;
+    forEachMention([&count](std::string_view) {
+        count++;
+    });
+    return count;
 }
 
-void Message::setSenderPeer(Peer *peer) {
-    sender_peer = peer;
+std::string_view Message::getChannel() const {
+    return getText(message_text_channel);
 }
 
-Peer *Message::getSenderPeer() const {
-    return sender_peer;
+std::span<const uint8_t> Message::getPacketSignature() const {
+    return {signature.data(), signature_size};
 }
 
-const std::vector<std::string> *Message::getMentions() const {
-    return &mentions;
+size_t Message::getTextBytes() const {
+    return text.capacity();
 }
 
-const std::string &Message::getChannel() const {
-    return channel;
+size_t Message::getHeldBytes() const {
+    return PacketBase::getHeldBytes() + getTextBytes();
 }
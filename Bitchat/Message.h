@@ -1,11 +1,29 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
-#include <string>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
 
 #include "PacketBase.h"
-#include "Peer.h"
 
+//Strings of a message, stored end to end in one block
+enum MessageText : uint8_t {
+    message_text_id = 0,
+    message_text_sender_nickname,
+    message_text_content,
+    message_text_encrypted_content,
+    message_text_original_sender_nickname,
+    message_text_recipient_nickname,
+    message_text_channel,
+    message_text_mentions, //each a length byte then the mention
+    message_text_count
+};
+
+//Ed25519, the only signature bitchat sends
+constexpr uint8_t message_signature_size = 64;
 
 class Message final : public PacketBase {
 public:
@@ -13,92 +31,122 @@ public:
 
     Message(uint8_t ttl, uint64_t timestamp, uint8_t packet_flags, uint64_t sender);
 
-    Message(uint8_t ttl, uint64_t timestamp, uint8_t packet_flags, uint64_t sender, uint64_t recipient, const std::string &signature);
+    //a signature longer than message_signature_size is cut short, callers turn those away first
+    Message(uint8_t ttl, uint64_t timestamp, uint8_t packet_flags, uint64_t sender, uint64_t recipient,
+            std::span<const uint8_t> signature = {});
 
     void setMessageFlags(uint8_t flags);
 
     [[nodiscard]] bool isRelay() const {
-        return (message_flags & 0x01) != 0;
+        return (message_flags & message_flag_is_relay) != 0;
     }
 
     [[nodiscard]] bool isPrivate() const {
-        return (message_flags & 0x02) != 0;
+        return (message_flags & message_flag_is_private) != 0;
     }
 
     [[nodiscard]] bool hasOriginalSender() const {
-        return (message_flags & 0x04) != 0;
+        return (message_flags & message_flag_has_original_sender) != 0;
     }
 
     [[nodiscard]] bool hasRecipientNickname() const {
-        return (message_flags & 0x08) != 0;
+        return (message_flags & message_flag_has_recipient_nickname) != 0;
     }
 
     [[nodiscard]] bool hasSenderPeerID() const {
-        return (message_flags & 0x10) != 0;
+        return (message_flags & message_flag_has_sender_peer_id) != 0;
     }
 
     [[nodiscard]] bool hasMentions() const {
-        return (message_flags & 0x20) != 0;
+        return (message_flags & message_flag_has_mentions) != 0;
     }
 
     [[nodiscard]] bool hasChannel() const {
-        return (message_flags & 0x40) != 0;
+        return (message_flags & message_flag_has_channel) != 0;
     }
 
     [[nodiscard]] bool isEncrypted() const {
-        return (message_flags & 0x80) != 0;
+        return (message_flags & message_flag_is_encrypted) != 0;
     }
 
     void setMessageTimestamp(uint64_t value);
 
-    void setMessageId(const std::string &string);
+    void setMessageId(std::string_view value);
+
+    void setSenderNickname(std::string_view value);
 
-    void setSenderNickname(const std::string &string);
+    void setContent(std::string_view value);
 
-    void setContent(const std::string &string);
+    void setEncryptedContent(std::string_view value);
 
-    void setEncryptedContent(const std::string &string);
+    void setOriginalSenderNickname(std::string_view value);
 
-    void setOriginalSenderNickname(const std::string &string);
+    void setRecipientNickname(std::string_view value);
 
-    void setRecipientNickname(const std::string &string);
+    void setSenderPeerId(uint64_t peer_id);
 
-    void setSenderPeer(Peer *peer);
+    //mentions are sent with a one byte length, anything longer is cut to fit
+    void addMention(std::string_view value);
 
-    void addMention(const std::string &string);
+    void setChannel(std::string_view value);
 
-    void setChannel(const std::string &string);
+    //every text field at once, mentions as length prefixed wire bytes, into a block allocated once at its size.
+    //Parsing uses this, the setters above are for building a message a field at a time
+    void setTexts(const std::array<std::string_view, message_text_count> &values);
 
     [[nodiscard]] uint8_t getMessageFlags() const;
 
     [[nodiscard]] uint64_t getMessageTimestamp() const;
 
-    [[nodiscard]] const std::string &getMessageId() const;
+    [[nodiscard]] std::string_view getMessageId() const;
+
+    [[nodiscard]] std::string_view getSenderNickname() const;
+
+    [[nodiscard]] std::string_view getContent() const;
+
+    [[nodiscard]] std::string_view getEncryptedContent() const;
 
-    [[nodiscard]] const std::string &getSenderNickname() const;
+    [[nodiscard]] std::string_view getOriginalSenderNickname() const;
 
-    [[nodiscard]] const std::string &getContent() const;
+    [[nodiscard]] std::string_view getRecipientNickname() const;
 
-    [[nodiscard]] const std::string &getOriginalSenderNickname() const;
+    [[nodiscard]] std::optional<uint64_t> getSenderPeerId() const;
 
-    [[nodiscard]] const std::string &getRecipientNickname() const;
+    [[nodiscard]] size_t getMentionCount() const;
 
-    [[nodiscard]] Peer *getSenderPeer() const;
+    template<typename Visit>
+    void forEachMention(Visit visit) const {
+        const auto mentions = getText(message_text_mentions);
+        for (size_t pos = 0; pos < mentions.size(); pos += 1 + static_cast<uint8_t>(mentions[pos])) {
+            visit(mentions.substr(pos + 1, static_cast<uint8_t>(mentions[pos])));
+        }
+    }
+
+    [[nodiscard]] std::string_view getChannel() const;
+
+    [[nodiscard]] std::span<const uint8_t> getPacketSignature() const override;
 
-    [[nodiscard]] const std::vector<std::string> *getMentions() const;
+    //heap bytes held for the text fields
+    [[nodiscard]] size_t getTextBytes() const;
 
-    [[nodiscard]] const std::string &getChannel() const;
+    [[nodiscard]] size_t getHeldBytes() const override;
 
 private:
+    [[nodiscard]] size_t textStart(MessageText field) const;
+
+    [[nodiscard]] std::string_view getText(MessageText field) const;
+
+    //everything in the field after its first keep bytes is replaced by value, the block is rebuilt at exactly its
+    //new size so a stored message holds no spare capacity
+    void replaceText(MessageText field, size_t keep, std::string_view value);
+
     uint8_t message_flags = 0;
+    uint8_t signature_size = 0;
+    bool sender_peer_id_set = false;
     uint64_t message_timestamp = 0;
-    std::string message_id{};
-    std::string sender_nickname{};
-    std::string original_sender_nickname{};
-    std::string content{};
-    std::string encrypted_content{};
-    std::string recipient_nickname{};
-    Peer *sender_peer;
-    std::vector<std::string> mentions;
-    std::string channel{};
+    uint64_t sender_peer_id = 0;
+    //where each string ends in text, each one starts where the one before it ended
+    std::array<uint16_t, message_text_count> text_ends{};
+    std::vector<char> text{};
+    std::array<uint8_t, message_signature_size> signature{};
 };
@@ -0,0 +1,273 @@
+#include "MessageCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#include "BinaryWriter.h"
+
+//Where each string field of a decoded message goes, mentions are kept as their wire bytes
+constexpr auto view_strings = [] {
+    std::array<std::string_view MessageView::*, message_field_count> strings{};
+    strings[message_field_id] = &MessageView::message_id;
+    strings[message_field_sender_nickname] = &MessageView::sender_nickname;
+    strings[message_field_content] = &MessageView::content;
+    strings[message_field_original_sender_nickname] = &MessageView::original_sender_nickname;
+    strings[message_field_recipient_nickname] = &MessageView::recipient_nickname;
+    strings[message_field_sender_peer_id] = &MessageView::sender_peer_id;
+    strings[message_field_channel] = &MessageView::channel;
+    return strings;
+}();
+
+//decode and encode take the wire type to say which member a field is, u8 the flags, u64 the timestamp, a list the
+//mentions and a string whatever view_strings has for it, so the schema has to agree
+constexpr bool schemaMatchesMembers() {
+    std::array<uint8_t, message_field_count> seen{};
+    for (const auto &[field, wire_type, present_flag]: message_schema) {
+        if (field >= message_field_count || seen[field]++ != 0) {
+            return false;
+        }
+        switch (wire_type) {
+            case MessageWireType::u8:
+                if (field != message_field_flags) {
+                    return false;
+                }
+                break;
+            case MessageWireType::u64:
+                if (field != message_field_timestamp) {
+                    return false;
+                }
+                break;
+            case MessageWireType::string_list_u8:
+                if (field != message_field_mentions) {
+                    return false;
+                }
+                break;
+            case MessageWireType::string_u8:
+            case MessageWireType::string_u16:
+                if (view_strings[field] == nullptr) {
+                    return false;
+                }
+                break;
+        }
+    }
+    //flags come first, every present_flag is read from them
+    return message_schema[0].field == message_field_flags;
+}
+
+static_assert(schemaMatchesMembers(), "each message field once, with the wire type of the member it goes in");
+
+static uint64_t readBigEndian(const uint8_t *data, const size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value = value << 8 | data[i];
+    }
+    return value;
+}
+
+static bool take(const uint8_t *&pos, const uint8_t *end, const size_t size, const uint8_t *&data) {
+    if (static_cast<size_t>(end - pos) < size) {
+        return false;
+    }
+    data = pos;
+    pos += size;
+    return true;
+}
+
+static bool takeString(const uint8_t *&pos, const uint8_t *end, const size_t length_size, std::string_view &field) {
+    const uint8_t *length = nullptr;
+    const uint8_t *data = nullptr;
+    if (!take(pos, end, length_size, length) || !take(pos, end, readBigEndian(length, length_size), data)) {
+        return false;
+    }
+    field = {reinterpret_cast<const char *>(data), static_cast<size_t>(pos - data)};
+    return true;
+}
+
+bool MessageCodec::decode(const std::span<const uint8_t> payload, MessageView &view) {
+    view = {};
+    auto pos = payload.data();
+    const auto end = pos + payload.size();
+    for (const auto &[field, wire_type, present_flag]: message_schema) {
+        if (present_flag != 0 && !(view.flags & present_flag)) {
+            continue;
+        }
+        const uint8_t *data = nullptr;
+        switch (wire_type) {
+            case MessageWireType::u8:
+                if (!take(pos, end, 1, data)) {
+                    return false;
+                }
+                view.flags = *data;
+                break;
+            case MessageWireType::u64:
+                if (!take(pos, end, 8, data)) {
+                    return false;
+                }
+                view.timestamp = readBigEndian(data, 8);
+                break;
+            case MessageWireType::string_u8:
+            case MessageWireType::string_u16:
+                if (!takeString(pos, end, wire_type == MessageWireType::string_u8 ? 1 : 2, view.*view_strings[field])) {
+                    return false;
+                }
+                break;
+            case MessageWireType::string_list_u8: {
+                if (!take(pos, end, 1, data)) {
+                    return false;
+                }
+                view.mention_count = *data;
+                const auto list_start = pos;
+                for (int i = 0; i < view.mention_count; i++) {
+                    if (std::string_view item; !takeString(pos, end, 1, item)) {
+                        return false;
+                    }
+                }
+                view.mentions = {list_start, static_cast<size_t>(pos - list_start)};
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+MessageReject MessageCodec::checkBudget(const MessageView &view) {
+    if (view.mention_count > message_max_mentions) {
+        return message_reject_mentions;
+    }
+    size_t bytes = view.mentions.size() - view.mention_count;
+    uint8_t allocations = view.mention_count + (view.mention_count > 0 ? 1 : 0); //each mention and their vector
+    for (const auto strings: view_strings) {
+        if (strings != nullptr && !(view.*strings).empty()) {
+            bytes += (view.*strings).size();
+            allocations++;
+        }
+    }
+    if (bytes > message_max_materialized_bytes) {
+        return message_reject_bytes;
+    }
+    if (allocations > message_max_allocations) {
+        return message_reject_allocations;
+    }
+    return message_reject_count;
+}
+
+//Counts the bytes an encode would write
+struct SizeSink {
+    size_t size = 0;
+
+    void u8(uint8_t) { size += 1; }
+    void u16(uint16_t) { size += 2; }
+    void u64(uint64_t) { size += 8; }
+    void data(std::string_view value) { size += value.size(); }
+};
+
+//Writes straight into memory already sized by SizeSink
+struct WriteSink {
+    uint8_t *out;
+
+    void u8(const uint8_t value) { *out++ = value; }
+
+    void u16(const uint16_t value) {
+        u8(static_cast<uint8_t>(value >> 8));
+        u8(static_cast<uint8_t>(value));
+    }
+
+    void u64(const uint64_t value) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            u8(static_cast<uint8_t>(value >> shift));
+        }
+    }
+
+    void data(const std::string_view value) {
+        memcpy(out, value.data(), value.size());
+        out += value.size();
+    }
+};
+
+static std::string_view messageString(const Message &message, const MessageField field,
+                                      std::array<char, 16> &peer_id_hex) {
+    switch (field) {
+        case message_field_id:
+            return message.getMessageId();
+        case message_field_sender_nickname:
+            return message.getSenderNickname();
+        case message_field_content:
+            return message.isEncrypted() ? message.getEncryptedContent() : message.getContent();
+        case message_field_original_sender_nickname:
+            return message.getOriginalSenderNickname();
+        case message_field_recipient_nickname:
+            return message.getRecipientNickname();
+        case message_field_sender_peer_id: {
+            const auto peer_id = message.getSenderPeerId();
+            if (!peer_id) {
+                return {};
+            }
+            for (int i = 0, shift = 60; shift >= 0; i++, shift -= 4) {
+                peer_id_hex[i] = static_cast<char>(BinaryWriter::hexify(*peer_id >> shift & 0xF));
+            }
+            return {peer_id_hex.data(), peer_id_hex.size()};
+        }
+        case message_field_channel:
+            return message.getChannel();
+        default:
+            return {};
+    }
+}
+
+template<typename Sink>
+static void encodeFields(const Message &message, Sink &sink) {
+    const auto flags = message.getMessageFlags();
+    std::array<char, 16> peer_id_hex{};
+    auto string_u8 = [&sink](const std::string_view value) {
+        const auto len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), value.size()));
+        sink.u8(len);
+        sink.data(value.substr(0, len));
+    };
+    for (const auto &[field, wire_type, present_flag]: message_schema) {
+        if (present_flag != 0 && !(flags & present_flag)) {
+            continue;
+        }
+        switch (wire_type) {
+            case MessageWireType::u8:
+                sink.u8(flags);
+                break;
+            case MessageWireType::u64:
+                sink.u64(message.getMessageTimestamp());
+                break;
+            case MessageWireType::string_u8:
+                string_u8(messageString(message, field, peer_id_hex));
+                break;
+            case MessageWireType::string_u16: {
+                const auto value = messageString(message, field, peer_id_hex);
+                const auto len = static_cast<uint16_t>(std::min(static_cast<size_t>(65535), value.size()));
+                sink.u16(len);
+                sink.data(value.substr(0, len));
+                break;
+            }
+            case MessageWireType::string_list_u8: {
+                const auto count = static_cast<uint8_t>(std::min(static_cast<size_t>(255), message.getMentionCount()));
+                sink.u8(count);
+                uint8_t written = 0;
+                message.forEachMention([&](const std::string_view mention) {
+                    if (written++ < count) {
+                        string_u8(mention);
+                    }
+                });
+                break;
+            }
+        }
+    }
+}
+
+size_t MessageCodec::encodedSize(const Message &message) {
+    SizeSink sink;
+    encodeFields(message, sink);
+    return sink.size;
+}
+
+uint8_t *MessageCodec::encode(const Message &message, uint8_t *out) {
+    WriteSink sink{out};
+    encodeFields(message, sink);
+    return sink.out;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "BitchatPacketTypes.h"
+#include "Message.h"
+#include "PacketView.h"
+
+//How a field of a message payload is laid out on the wire, multi byte values are big endian
+enum class MessageWireType : uint8_t {
+    u8,
+    u64,
+    string_u8, //u8 length then the bytes
+    string_u16, //u16 length then the bytes
+    string_list_u8, //u8 count then each as a string_u8
+};
+
+enum MessageField : uint8_t {
+    message_field_flags = 0,
+    message_field_timestamp,
+    message_field_id,
+    message_field_sender_nickname,
+    message_field_content,
+    message_field_original_sender_nickname,
+    message_field_recipient_nickname,
+    message_field_sender_peer_id,
+    message_field_mentions,
+    message_field_channel,
+    message_field_count
+};
+
+struct MessageFieldDescriptor {
+    MessageField field;
+    MessageWireType wire_type;
+    //message flag saying the field is there, 0 for the fields that always are
+    uint8_t present_flag;
+};
+
+//The message payload in wire order, decode, encode and encodedSize all walk this
+constexpr std::array<MessageFieldDescriptor, message_field_count> message_schema{{
+    {message_field_flags, MessageWireType::u8, 0},
+    {message_field_timestamp, MessageWireType::u64, 0},
+    {message_field_id, MessageWireType::string_u8, 0},
+    {message_field_sender_nickname, MessageWireType::string_u8, 0},
+    {message_field_content, MessageWireType::string_u16, 0},
+    {message_field_original_sender_nickname, MessageWireType::string_u8, message_flag_has_original_sender},
+    {message_field_recipient_nickname, MessageWireType::string_u8, message_flag_has_recipient_nickname},
+    {message_field_sender_peer_id, MessageWireType::string_u8, message_flag_has_sender_peer_id},
+    {message_field_mentions, MessageWireType::string_list_u8, message_flag_has_mentions},
+    {message_field_channel, MessageWireType::string_u8, message_flag_has_channel},
+}};
+
+//Most a single message may cost to turn into a Message, whatever its lengths claim
+constexpr size_t message_max_materialized_bytes = 2048;
+constexpr uint8_t message_max_allocations = 16;
+constexpr uint8_t message_max_mentions = 10;
+
+enum MessageReject : uint8_t {
+    message_reject_malformed = 0, //a field runs past the end of the payload
+    message_reject_bytes, //more string bytes than message_max_materialized_bytes
+    message_reject_allocations, //more strings than message_max_allocations
+    message_reject_mentions, //more mentions than message_max_mentions
+    message_reject_count
+};
+
+using MessageRejectCounts = std::array<uint32_t, message_reject_count>;
+
+class MessageCodec {
+public:
+    //fills the view in one pass over the payload, false if a field runs past the end
+    static bool decode(std::span<const uint8_t> payload, MessageView &view);
+
+    //checked on the view before anything is copied out of it, message_reject_count if it is within budget
+    [[nodiscard]] static MessageReject checkBudget(const MessageView &view);
+
+    //exactly what encode writes, so a frame can be sized before anything goes into it
+    [[nodiscard]] static size_t encodedSize(const Message &message);
+
+    //writes encodedSize(message) bytes from out, returns the end of what was written
+    static uint8_t *encode(const Message &message, uint8_t *out);
+};
@@ -1,5 +1,6 @@
 #include "PacketBase.h"
 
+#include <ranges>
 #include <string>
 #include <utility>
 
@@ -17,14 +18,13 @@ PacketBase::PacketBase(const uint8_t type, const uint8_t ttl, const uint64_t tim
 }
 
 PacketBase::PacketBase(const uint8_t type, const uint8_t ttl, const uint64_t timestamp, const uint8_t flags,
-                       const uint64_t sender, const uint64_t recipient, const std::string &signature)
+                       const uint64_t sender, const uint64_t recipient)
     : packet_type(type),
       packet_ttl(ttl),
       packet_timestamp(timestamp),
       packet_flags(flags),
       packet_sender_id(sender),
-      packet_recipient_id(recipient),
-      packet_signature(signature) {
+      packet_recipient_id(recipient) {
 }
 
 uint8_t PacketBase::getPacketType() const {
@@ -55,22 +55,82 @@ uint64_t PacketBase::getPacketRecipientId() const {
     return packet_recipient_id;
 }
 
-const std::string &PacketBase::getPacketSignature() const {
-    return packet_signature;
+std::span<const uint8_t> PacketBase::getPacketSignature() const {
+    return {};
 }
 
 void PacketBase::setPacketTtl(const uint8_t ttl) {
     packet_ttl = ttl;
+    invalidateEncodedFrame();
 }
 
 void PacketBase::setPacketTimestamp(const uint64_t timestamp) {
     packet_timestamp = timestamp;
+    invalidateEncodedFrame();
 }
 
 void PacketBase::setPacketFlags(const uint8_t flags) {
     packet_flags = flags;
+    invalidateEncodedFrame();
 }
 
 void PacketBase::setPacketSenderId(const uint64_t senderId) {
     packet_sender_id = senderId;
+    invalidateEncodedFrame();
+}
+
+const std::vector<uint8_t> *PacketBase::getReceivedFrame() const {
+    return nullptr;
+}
+
+const EncodedFrame &PacketBase::getEncodedFrame() const {
+    return encoded_frame;
+}
+
+void PacketBase::setEncodedFrame(EncodedFrame frame) const {
+    encoded_frame = std::move(frame);
+}
+
+EncodedFragments PacketBase::getEncodedFragments(const uint16_t max_frame_size) const {
+    for (const auto &[frame_size, fragments]: encoded_fragments) {
+        if (frame_size == max_frame_size) {
+            return fragments;
+        }
+    }
+    return {};
+}
+
+void PacketBase::addEncodedFragments(const uint16_t max_frame_size, EncodedFragments fragments) const {
+    encoded_fragments.emplace_back(max_frame_size, std::move(fragments));
+}
+
+size_t PacketBase::getHeldBytes() const {
+    size_t bytes = encoded_frame ? encoded_frame->capacity() : 0;
+    for (const auto &fragments: encoded_fragments | std::views::values) {
+        for (const auto &fragment: *fragments) {
+            bytes += fragment->capacity();
+        }
+    }
+    return bytes + encoded_fragments.capacity() * sizeof(encoded_fragments.front());
+}
+
+bool PacketBase::isDeliveredTo(const uint8_t slot) const {
+    return slot != no_connection_slot && (delivered_to & (1u << slot)) != 0;
+}
+
+void PacketBase::markDeliveredTo(const uint8_t slot) const {
+    if (slot != no_connection_slot) {
+        delivered_to |= 1u << slot;
+    }
+}
+
+void PacketBase::clearDeliveredTo(const uint8_t slot) const {
+    if (slot != no_connection_slot) {
+        delivered_to &= ~(1u << slot);
+    }
+}
+
+void PacketBase::invalidateEncodedFrame() {
+    encoded_frame.reset();
+    encoded_fragments.clear();
 }
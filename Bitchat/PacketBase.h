@@ -1,18 +1,29 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "BitchatPacketTypes.h"
 
+//Immutable wire encoding of a packet, shared between every connection queue it is sent on
+using EncodedFrame = std::shared_ptr<const std::vector<uint8_t>>;
+//The encoded frame split into fragment packets that each fit one link frame size
+using EncodedFragments = std::shared_ptr<const std::vector<EncodedFrame>>;
+//One bit per connection slot, set once the packet has been sent to or received from that connection
+using DeliveryMask = uint8_t;
+constexpr uint8_t no_connection_slot = 0xff;
+
 class PacketBase {
 public:
     explicit PacketBase(uint8_t type);
 
     PacketBase(uint8_t type, uint8_t ttl, uint64_t timestamp, uint8_t flags, uint64_t sender);
 
-    PacketBase(uint8_t type, uint8_t ttl, uint64_t timestamp, uint8_t flags, uint64_t sender, uint64_t recipient,
-               const std::string &signature);
+    PacketBase(uint8_t type, uint8_t ttl, uint64_t timestamp, uint8_t flags, uint64_t sender, uint64_t recipient);
 
     virtual ~PacketBase() = default;
 
@@ -30,7 +41,8 @@ public:
 
     [[nodiscard]] uint64_t getPacketRecipientId() const;
 
-    [[nodiscard]] const std::string &getPacketSignature() const;
+    //only a message built here carries one, a relayed packet's stays in its received frame
+    [[nodiscard]] virtual std::span<const uint8_t> getPacketSignature() const;
 
     [[nodiscard]] bool hasPacketRecipient() const {
         return (packet_flags & packet_flag_has_recipient) != 0;
@@ -48,6 +60,29 @@ public:
 
     void setPacketSenderId(uint64_t senderId);
 
+    //the frame exactly as it arrived, if this packet is relayed as received rather than rebuilt from its fields
+    [[nodiscard]] virtual const std::vector<uint8_t> *getReceivedFrame() const;
+
+    [[nodiscard]] const EncodedFrame &getEncodedFrame() const;
+
+    void setEncodedFrame(EncodedFrame frame) const;
+
+    [[nodiscard]] EncodedFragments getEncodedFragments(uint16_t max_frame_size) const;
+
+    void addEncodedFragments(uint16_t max_frame_size, EncodedFragments fragments) const;
+
+    //heap bytes held on top of the object itself, the cached encodings included
+    [[nodiscard]] virtual size_t getHeldBytes() const;
+
+    [[nodiscard]] bool isDeliveredTo(uint8_t slot) const;
+
+    void markDeliveredTo(uint8_t slot) const;
+
+    void clearDeliveredTo(uint8_t slot) const;
+
+protected:
+    void invalidateEncodedFrame();
+
 private:
     uint8_t packet_type = 0;
     uint8_t packet_ttl = 0;
@@ -55,5 +90,10 @@ private:
     uint8_t packet_flags = 0;
     uint64_t packet_sender_id = 0;
     uint64_t packet_recipient_id = 0;
-    std::string packet_signature{};
+    //built on first send, dropped whenever a field that is written out changes
+    mutable EncodedFrame encoded_frame{};
+    //fragment sets keyed by the frame size they were cut for, links with the same MTU share one
+    mutable std::vector<std::pair<uint16_t, EncodedFragments>> encoded_fragments{};
+    //relay bookkeeping rather than packet content, so it can change on a stored const packet
+    mutable DeliveryMask delivered_to{};
 };
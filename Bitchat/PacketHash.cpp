@@ -0,0 +1,128 @@
+#include "PacketHash.h"
+
+#include <bit>
+#include <cstring>
+
+constexpr uint64_t prime1 = 0x9e3779b185ebca87;
+constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4f;
+constexpr uint64_t prime3 = 0x165667b19e3779f9;
+constexpr uint64_t prime4 = 0x85ebca77c2b2ae63;
+constexpr uint64_t prime5 = 0x27d4eb2f165667c5;
+
+static uint64_t rotateLeft(const uint64_t value, const int bits) {
+    return value << bits | value >> (64 - bits);
+}
+
+//both targets are little endian, a big endian one swaps so the value stays the same
+static uint64_t readLittleEndian64(const uint8_t *data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+static uint64_t readLittleEndian32(const uint8_t *data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+static uint64_t round(uint64_t accumulator, const uint64_t input) {
+    accumulator += input * prime2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * prime1;
+}
+
+static uint64_t mergeRound(uint64_t accumulator, const uint64_t lane) {
+    accumulator ^= round(0, lane);
+    return accumulator * prime1 + prime4;
+}
+
+PacketHasher::PacketHasher(const uint64_t seed)
+    : seed(seed), lanes{seed + prime1 + prime2, seed + prime2, seed, seed - prime1} {
+}
+
+void PacketHasher::consumeStripe(const uint8_t *stripe) {
+    for (int lane = 0; lane < 4; lane++) {
+        lanes[lane] = round(lanes[lane], readLittleEndian64(stripe + lane * 8));
+    }
+}
+
+PacketHasher &PacketHasher::addFieldSpanning(const uint64_t value, const uint8_t size) {
+    uint8_t bytes[sizeof(value)];
+    for (int i = 0, shift = (size - 1) * 8; i < size; i++, shift -= 8) {
+        bytes[i] = static_cast<uint8_t>(value >> shift);
+    }
+    return add(std::span(bytes, size));
+}
+
+PacketHasher &PacketHasher::add(const std::string_view data) {
+    return add(std::span(reinterpret_cast<const uint8_t *>(data.data()), data.size()));
+}
+
+PacketHasher &PacketHasher::add(std::span<const uint8_t> data) {
+    total_size += data.size();
+    auto pos = data.data();
+    auto size = data.size();
+    //header fields land here, nothing to do until a stripe fills
+    if (pending_size + size < pending.size()) {
+        std::memcpy(pending.data() + pending_size, pos, size);
+        pending_size += size;
+        return *this;
+    }
+    if (pending_size > 0) {
+        const auto fill = pending.size() - pending_size;
+        std::memcpy(pending.data() + pending_size, pos, fill);
+        consumeStripe(pending.data());
+        pos += fill;
+        size -= fill;
+    }
+    for (; size >= pending.size(); pos += pending.size(), size -= pending.size()) {
+        consumeStripe(pos);
+    }
+    std::memcpy(pending.data(), pos, size);
+    pending_size = size;
+    return *this;
+}
+
+uint64_t PacketHasher::finish() const {
+    uint64_t hash;
+    if (total_size >= pending.size()) {
+        hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) +
+               rotateLeft(lanes[3], 18);
+        for (const auto lane: lanes) {
+            hash = mergeRound(hash, lane);
+        }
+    } else {
+        hash = seed + prime5;
+    }
+    hash += total_size;
+
+    auto pos = pending.data();
+    const auto end = pos + pending_size;
+    for (; end - pos >= 8; pos += 8) {
+        hash ^= round(0, readLittleEndian64(pos));
+        hash = rotateLeft(hash, 27) * prime1 + prime4;
+    }
+    if (end - pos >= 4) {
+        hash ^= readLittleEndian32(pos) * prime1;
+        hash = rotateLeft(hash, 23) * prime2 + prime3;
+        pos += 4;
+    }
+    for (; pos < end; pos++) {
+        hash ^= *pos * prime5;
+        hash = rotateLeft(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+//Streaming XXH64, fed a packet's fields in turn without gathering them anywhere first. Multi byte values go in
+//big endian as they are on the wire, so the same packet hashes the same on the device and the host
+class PacketHasher {
+public:
+    explicit PacketHasher(uint64_t seed = 0);
+
+    //fields short of a whole stripe are only copied, inline so a header costs no more than gathering it by hand
+    PacketHasher &add(const uint8_t value) {
+        return addField(value, 1);
+    }
+
+    PacketHasher &add(const uint16_t value) {
+        return addField(value, 2);
+    }
+
+    PacketHasher &add(const uint64_t value) {
+        return addField(value, 8);
+    }
+
+    PacketHasher &add(std::span<const uint8_t> data);
+
+    PacketHasher &add(std::string_view data);
+
+    [[nodiscard]] uint64_t finish() const;
+
+private:
+    PacketHasher &addField(const uint64_t value, const uint8_t size) {
+        if (pending_size + size < pending.size()) {
+            uint64_t wire = value << (64 - size * 8);
+            if constexpr (std::endian::native == std::endian::little) {
+                wire = std::byteswap(wire);
+            }
+            std::memcpy(pending.data() + pending_size, &wire, size);
+            pending_size += size;
+            total_size += size;
+            return *this;
+        }
+        return addFieldSpanning(value, size);
+    }
+
+    PacketHasher &addFieldSpanning(uint64_t value, uint8_t size);
+
+    void consumeStripe(const uint8_t *stripe);
+
+    uint64_t seed;
+    std::array<uint64_t, 4> lanes{};
+    //bytes short of a whole 32 byte stripe
+    std::array<uint8_t, 32> pending{};
+    uint8_t pending_size = 0;
+    uint64_t total_size = 0;
+};
+
+//Two independently seeded hashes, for when a collision between stored packets has to be all but impossible
+struct PacketHash128 {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    auto operator<=>(const PacketHash128 &) const = default;
+};
+
+class PacketHasher128 {
+public:
+    template<typename Value>
+    PacketHasher128 &add(Value value) {
+        high.add(value);
+        low.add(value);
+        return *this;
+    }
+
+    [[nodiscard]] PacketHash128 finish() const {
+        return {high.finish(), low.finish()};
+    }
+
+private:
+    PacketHasher high{0};
+    PacketHasher low{0x9e3779b97f4a7c15};
+};
@@ -1,36 +1,63 @@
 #include "PacketPassAlong.h"
-#include <vector>
-
-#include "BinaryWriter.h"
 
 PacketPassAlong::PacketPassAlong() : PacketBase(type_unknown) {
 }
 
 PacketPassAlong::PacketPassAlong(const uint8_t type, const uint8_t ttl, const uint64_t timestamp, const uint8_t flags,
-                                 const uint64_t sender, const uint64_t recipient, const std::string &signature)
-    : PacketBase(type, ttl, timestamp, flags, sender, recipient, signature) {
+                                 const uint64_t sender, const uint64_t recipient)
+    : PacketBase(type, ttl, timestamp, flags, sender, recipient) {
 }
 
 void PacketPassAlong::setPayload(std::string &value) {
     payload = value;
+    received_frame.clear();
+    invalidateEncodedFrame();
 }
 
-const std::string &PacketPassAlong::getPayload() const {
+std::string_view PacketPassAlong::getPayload() const {
+    if (!received_frame.empty()) {
+        return {reinterpret_cast<const char *>(received_frame.data()) + received_payload_offset,
+                received_payload_length};
+    }
     return payload;
 }
 
-std::size_t PacketPassAlong::getPacketHash() const {
-    const std::size_t hash_payload = std::hash<std::string>{}(payload);
-    std::vector<uint8_t> meta_buffer;
-    const BinaryWriter writer(meta_buffer);
-    writer.write_uint8(getPacketType());
-    //ignore ttl for hash as we want to ignore the same message going around again
-    writer.write_uint8(getPacketFlags());
-    writer.write_uint64(getPacketTimestamp());
-    writer.write_uint64(getPacketSenderId());
-    writer.write_uint64(getPacketRecipientId());
-    std::string meta_string;
-    meta_string.assign(reinterpret_cast<const char *>(meta_buffer.data()), meta_buffer.size());
-    const std::size_t hash_meta = std::hash<std::string>{}(meta_string);
-    return hash_payload ^ (hash_meta << 1);
+void PacketPassAlong::setReceivedFrame(const std::span<const uint8_t> frame,
+                                       const std::span<const uint8_t> frame_payload) {
+    received_frame.assign(frame.begin(), frame.end());
+    received_payload_offset = frame_payload.data() - frame.data();
+    received_payload_length = frame_payload.size();
+    payload.clear();
+    invalidateEncodedFrame();
+}
+
+const std::vector<uint8_t> *PacketPassAlong::getReceivedFrame() const {
+    return received_frame.empty() ? nullptr : &received_frame;
+}
+
+size_t PacketPassAlong::getHeldBytes() const {
+    return PacketBase::getHeldBytes() + payload.capacity() + received_frame.capacity();
+}
+
+uint64_t PacketPassAlong::getPacketHash() const {
+    return packetHash(getPacketType(), getPacketFlags(), getPacketTimestamp(), getPacketSenderId(),
+                      getPacketRecipientId(), getPayload());
+}
+
+//ignore ttl for hash as we want to ignore the same message going around again
+template<typename Hasher>
+static auto hashPacket(Hasher hasher, const uint8_t type, const uint8_t flags, const uint64_t timestamp,
+                       const uint64_t sender, const uint64_t recipient, const std::string_view payload) {
+    return hasher.add(type).add(flags).add(timestamp).add(sender).add(recipient).add(payload).finish();
+}
+
+uint64_t PacketPassAlong::packetHash(const uint8_t type, const uint8_t flags, const uint64_t timestamp,
+                                     const uint64_t sender, const uint64_t recipient, const std::string_view payload) {
+    return hashPacket(PacketHasher(), type, flags, timestamp, sender, recipient, payload);
+}
+
+PacketHash128 PacketPassAlong::packetHash128(const uint8_t type, const uint8_t flags, const uint64_t timestamp,
+                                             const uint64_t sender, const uint64_t recipient,
+                                             const std::string_view payload) {
+    return hashPacket(PacketHasher128(), type, flags, timestamp, sender, recipient, payload);
 }
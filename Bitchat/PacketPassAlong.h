@@ -1,6 +1,10 @@
 #pragma once
 
+#include <span>
+#include <string_view>
+
 #include "PacketBase.h"
+#include "PacketHash.h"
 
 
 class PacketPassAlong final : public PacketBase {
@@ -8,15 +12,33 @@ public:
     PacketPassAlong();
 
     explicit PacketPassAlong(uint8_t type, uint8_t ttl, uint64_t timestamp, uint8_t flags, uint64_t sender,
-                             uint64_t recipient, const std::string &signature);
-
+                             uint64_t recipient);
 
     void setPayload(std::string &value);
 
-    [[nodiscard]] const std::string &getPayload() const;
+    [[nodiscard]] std::string_view getPayload() const;
+
+    //takes a copy of the frame as its only buffer, the payload must lie within it
+    void setReceivedFrame(std::span<const uint8_t> frame, std::span<const uint8_t> frame_payload);
+
+    [[nodiscard]] const std::vector<uint8_t> *getReceivedFrame() const override;
+
+    [[nodiscard]] uint64_t getPacketHash() const;
+
+    [[nodiscard]] size_t getHeldBytes() const override;
+
+    static uint64_t packetHash(uint8_t type, uint8_t flags, uint64_t timestamp, uint64_t sender, uint64_t recipient,
+                               std::string_view payload);
 
-    [[nodiscard]] std::size_t getPacketHash() const;
+    //same fields through two lanes, for a store that can't afford to confuse two packets
+    static PacketHash128 packetHash128(uint8_t type, uint8_t flags, uint64_t timestamp, uint64_t sender,
+                                       uint64_t recipient, std::string_view payload);
 
 private:
+    //set when the packet is built here, a received packet reads its payload out of the frame instead
     std::string payload;
+    //header, payload still compressed if it was and signature, only the ttl is patched when it is sent on
+    std::vector<uint8_t> received_frame;
+    uint16_t received_payload_offset = 0;
+    uint16_t received_payload_length = 0;
 };
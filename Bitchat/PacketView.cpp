@@ -0,0 +1,71 @@
+#include "PacketView.h"
+
+#include <algorithm>
+
+#include "BinaryReader.h"
+#include "BitchatPacketTypes.h"
+#include "MessageCodec.h"
+#include "PacketHash.h"
+
+constexpr uint8_t signature_length = 64;
+//enough of the payload to cover a fragment's id and index, which is all that tells fragments of a packet apart
+constexpr size_t admission_payload_prefix = 16;
+
+bool PacketView::parse(const uint8_t *buffer, const uint16_t offset, const uint16_t buffer_size, PacketView &view) {
+    BinaryReader reader(offset, buffer, buffer_size);
+    view.version = reader.read_uint8();
+    if (view.version != 1) {
+        return false;
+    }
+    view.type = reader.read_uint8();
+    view.ttl = reader.read_uint8();
+    view.timestamp_ms = reader.read_uint64(); //time in ms since 1970
+    view.flags = reader.read_uint8();
+    auto payload_length = reader.read_uint16();
+    view.sender = reader.read_uint64();
+    view.recipient = 0;
+    if (view.flags & packet_flag_has_recipient) {
+        view.recipient = reader.read_uint64();
+    }
+    view.original_size = 0;
+    if (view.flags & packet_flag_is_compressed) {
+        //compressed gives original size before payload, counted in the payload length for simpler clients
+        if (payload_length < 2) {
+            return false;
+        }
+        view.original_size = reader.read_uint16();
+        payload_length -= 2;
+    }
+    const auto payload = reader.read_data(payload_length);
+    if (payload == nullptr) {
+        return false;
+    }
+    view.payload = {payload, payload_length};
+    view.signature = {};
+    if (view.flags & packet_flag_has_signature) {
+        const auto signature = reader.read_data(signature_length);
+        if (signature == nullptr) {
+            return false;
+        }
+        view.signature = {signature, signature_length};
+    }
+    view.frame = {buffer + offset, static_cast<size_t>(buffer_size - offset)};
+    return true;
+}
+
+bool MessageView::parse(const std::span<const uint8_t> payload, MessageView &view) {
+    return MessageCodec::decode(payload, view);
+}
+
+uint64_t PacketView::admissionKey() const {
+    const auto prefix = std::min(payload.size(), admission_payload_prefix);
+    return PacketHasher()
+            .add(type)
+            .add(static_cast<uint8_t>(flags & packet_flag_has_recipient))
+            .add(timestamp_ms)
+            .add(sender)
+            .add(recipient)
+            .add(static_cast<uint16_t>(payload.size()))
+            .add(payload.first(prefix))
+            .finish();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+//Header and fields of an inbound frame, read in place from the receive buffer without copying anything out
+struct PacketView {
+    uint8_t version = 0;
+    uint8_t type = 0;
+    uint8_t ttl = 0;
+    uint64_t timestamp_ms = 0;
+    uint8_t flags = 0;
+    uint64_t sender = 0;
+    uint64_t recipient = 0;
+    //size before compression, only set when the flags say the payload is compressed
+    uint16_t original_size = 0;
+    //as it arrived, still compressed if it was
+    std::span<const uint8_t> payload{};
+    std::span<const uint8_t> signature{};
+    //the whole frame, which a relayed packet keeps as its only buffer
+    std::span<const uint8_t> frame{};
+
+    static bool parse(const uint8_t *buffer, uint16_t offset, uint16_t buffer_size, PacketView &view);
+
+    //identifies copies of one packet from the header and the first bytes of the payload, ignoring the ttl,
+    //cheap enough to run before anything is decompressed or copied
+    [[nodiscard]] uint64_t admissionKey() const;
+};
+
+//Fields of a message payload as views into the (decompressed) payload buffer
+struct MessageView {
+    uint8_t flags = 0;
+    uint64_t timestamp = 0;
+    std::string_view message_id{};
+    std::string_view sender_nickname{};
+    std::string_view content{};
+    std::string_view original_sender_nickname{};
+    std::string_view recipient_nickname{};
+    std::string_view sender_peer_id{};
+    uint8_t mention_count = 0;
+    //each mention length prefixed, walk them with forEachMention
+    std::span<const uint8_t> mentions{};
+    std::string_view channel{};
+
+    static bool parse(std::span<const uint8_t> payload, MessageView &view);
+
+    template<typename Visit>
+    void forEachMention(Visit visit) const {
+        for (size_t pos = 0, i = 0; i < mention_count && pos < mentions.size(); i++) {
+            const auto len = mentions[pos];
+            visit(std::string_view(reinterpret_cast<const char *>(&mentions[pos + 1]), len));
+            pos += 1 + len;
+        }
+    }
+};
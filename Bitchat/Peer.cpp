@@ -29,6 +29,18 @@ std::vector<uint8_t> &Peer::getPublicKey() {
     return public_key;
 }
 
+size_t Peer::getHeldBytes() const {
+    return name.capacity() + public_key.capacity();
+}
+
+uint64_t Peer::getLastSeenMs() const {
+    return last_seen_ms;
+}
+
+void Peer::setLastSeenMs(const uint64_t now_ms) {
+    last_seen_ms = now_ms;
+}
+
 uint8_t Peer::getAnnounceTtl() const {
     return max_ttl;
 }
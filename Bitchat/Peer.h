@@ -27,11 +27,20 @@ public:
 
     void setConnectionHandle(uint16_t hci_con_handle);
 
+    //heap bytes held for the name and key
+    [[nodiscard]] size_t getHeldBytes() const;
+
+    //our uptime when a packet from the peer last arrived
+    [[nodiscard]] uint64_t getLastSeenMs() const;
+
+    void setLastSeenMs(uint64_t now_ms);
+
 private:
     uint64_t id{};
     std::string name{};
     std::vector<uint8_t> public_key{};
     uint8_t max_ttl{};
     uint16_t connection_handle{};
+    uint64_t last_seen_ms{};
 };
 
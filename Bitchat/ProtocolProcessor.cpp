@@ -9,11 +9,12 @@
 #include <string>
 #include <cinttypes>
 
-#include "BinaryReader.h"
 #include "BitchatPacketTypes.h"
 #include "ProtocolWriter.h"
 #include "libdeflate.h"
 #include "PacketPassAlong.h"
+#include "MessageCodec.h"
+#include "PacketView.h"
 
 extern void print_named_data(const char *name, const uint8_t *data, uint16_t data_size);
 
@@ -68,12 +69,21 @@ const char *ProtocolProcessor::stringForType(const uint8_t type) {
     }
 }
 
+ProtocolProcessor::ProtocolProcessor(BleConnectionTracker &ble_connection_tracker)
+    : ble_connection_tracker(ble_connection_tracker), decompressor(libdeflate_alloc_decompressor()),
+      decompressed(max_decompressed_size) {
+}
+
+ProtocolProcessor::~ProtocolProcessor() {
+    libdeflate_free_decompressor(decompressor);
+}
+
 void ProtocolProcessor::updateOrStorePeerName(const uint64_t sender, const std::string &peer_name, uint8_t ttl, BleConnection &connection) const {
     auto &peer = ble_connection_tracker.checkSenderInPeers(sender);
     peer.updateName(peer_name);
     if (ttl >= peer.getAnnounceTtl()) {
         peer.setAnnounceTtl(ttl);
-        ble_connection_tracker.setConnectionHandleForPeer(connection.getConnectionHandle(), &peer);
+        ble_connection_tracker.setConnectionHandleForPeer(connection.getConnectionHandle(), sender);
     }
 }
 
@@ -83,225 +93,174 @@ void ProtocolProcessor::updateOrStorePeerNoisePublicKey(const uint64_t sender,
     peer.updateNoisePublicKey(public_key);
 }
 
-bool ProtocolProcessor::processMessage(Message &message, const uint8_t *payload, uint16_t payload_length) const {
-    if (payload_length < 13) {
-        LOG_DEBUG("Payload too small to be a message: %d\n", payload_length);
-        return false;
-    }
-
-    BinaryReader reader(0, payload, payload_length);
-    message.setMessageFlags(reader.read_uint8());
-    message.setMessageTimestamp(reader.read_uint64());
-
-    const auto id_len = reader.read_uint8();
-    const auto id = reader.read_data(id_len);
-    if (id == nullptr) {
-        LOG_DEBUG("Data corrupted: invalid message id\n");
-        return false;
+bool ProtocolProcessor::processMessage(Message &message, const MessageView &view) const {
+    message.setMessageFlags(view.flags);
+    message.setMessageTimestamp(view.timestamp);
+    //the strings go in as one block, mentions keep the length prefixed layout they arrived in
+    std::array<std::string_view, message_text_count> texts{};
+    texts[message_text_id] = view.message_id;
+    texts[message_text_sender_nickname] = view.sender_nickname;
+    texts[message.isEncrypted() ? message_text_encrypted_content : message_text_content] = view.content;
+    if (message.hasOriginalSender()) {
+        texts[message_text_original_sender_nickname] = view.original_sender_nickname;
     }
-    print_named_data("message id", id, id_len);
-    message.setMessageId(std::string(reinterpret_cast<const char *>(id), id_len));
-
-    const auto sender_len = reader.read_uint8();
-    const auto sender = reader.read_data(sender_len);
-    if (sender == nullptr) {
-        LOG_DEBUG("Data corrupted: invalid sender nickname id\n");
-        return false;
+    if (message.hasRecipientNickname()) {
+        texts[message_text_recipient_nickname] = view.recipient_nickname;
     }
-    print_named_data("sender", sender, sender_len);
-    message.setSenderNickname(std::string(reinterpret_cast<const char *>(sender), sender_len));
-
-    const auto content_len = reader.read_uint16();
-    const auto content = reader.read_data(content_len);
-    if (content == nullptr) {
-        LOG_DEBUG("Data corrupted: invalid content\n");
-        return false;
+    if (message.hasMentions()) {
+        texts[message_text_mentions] = {reinterpret_cast<const char *>(view.mentions.data()), view.mentions.size()};
     }
-    print_named_data("content", content, content_len);
-    if (message.isEncrypted()) {
-        message.setEncryptedContent(std::string(reinterpret_cast<const char *>(content), content_len));
-    } else {
-        message.setContent(std::string(reinterpret_cast<const char *>(content), content_len));
+    if (message.hasChannel()) {
+        texts[message_text_channel] = view.channel;
     }
-
-    if (message.hasOriginalSender()) {
-        const auto original_sender_len = reader.read_uint8();
-        const auto original_sender = reader.read_data(original_sender_len);
-        if (original_sender == nullptr) {
-            LOG_DEBUG("Data corrupted: invalid original_sender\n");
-            return false;
+    message.setTexts(texts);
+    if (message.hasSenderPeerID() && view.sender_peer_id.size() == 16) {
+        const auto sender_peer_id = view.sender_peer_id;
+        uint64_t peer_id = 0;
+        for (int shift_by = 56, i = 0; i < 16; shift_by -= 8, i++) {
+            uint8_t uint8 = (sender_peer_id[i] & '@' ? sender_peer_id[i] + 9 : sender_peer_id[i]) << 4;
+            i++;
+            uint8 |= (sender_peer_id[i] & '@' ? sender_peer_id[i] + 9 : sender_peer_id[i]) & 0xF;
+            peer_id |= static_cast<uint64_t>(uint8) << shift_by;
         }
-        print_named_data("original_sender", original_sender, original_sender_len);
-        message.setOriginalSenderNickname(std::string(reinterpret_cast<const char *>(original_sender),
-                                                      original_sender_len));
+        ble_connection_tracker.checkSenderInPeers(peer_id);
+        message.setSenderPeerId(peer_id);
     }
+    return true;
+}
 
-    if (message.hasRecipientNickname()) {
-        const auto recipient_nickname_len = reader.read_uint8();
-        const auto recipient_nickname = reader.read_data(recipient_nickname_len);
-        if (recipient_nickname == nullptr) {
-            LOG_DEBUG("Data corrupted: invalid recipient_nickname\n");
-            return false;
+size_t ProtocolProcessor::processInbound(const uint32_t budget_bytes) const {
+    auto &inbound_ring = ble_connection_tracker.getInboundRing();
+    uint32_t processed_bytes = 0;
+    size_t processed = 0;
+    InboundFrame frame;
+    //at least one each time so a frame bigger than the budget still gets through
+    while ((processed == 0 || processed_bytes < budget_bytes) && inbound_ring.front(frame)) {
+        if (frame.con_handle != inbound_discarded_handle) {
+            auto &connection = ble_connection_tracker.connectionForConnHandle(frame.con_handle);
+            processWrite(connection, 0, frame.data, frame.size);
         }
-        print_named_data("recipient_nickname", recipient_nickname, recipient_nickname_len);
-        message.setRecipientNickname(std::string(reinterpret_cast<const char *>(recipient_nickname),
-                                                 recipient_nickname_len));
+        inbound_ring.pop();
+        processed_bytes += frame.size;
+        processed++;
     }
+    return processed;
+}
 
-    if (message.hasSenderPeerID()) {
-        const auto sender_peer_id_len = reader.read_uint8();
-        const auto sender_peer_id = reader.read_data(sender_peer_id_len);
-        if (sender_peer_id == nullptr) {
-            LOG_DEBUG("Data corrupted: invalid sender_peer_id\n");
-            return false;
-        }
-        print_named_data("sender_peer_id", sender_peer_id, sender_peer_id_len);
-        if (sender_peer_id_len == 16) {
-            uint64_t peer_id = 0;
-            for (int shift_by = 56, i = 0; i < sender_peer_id_len; shift_by -= 8, i++) {
-                uint8_t uint8 = (sender_peer_id[i] & '@' ? sender_peer_id[i] + 9 : sender_peer_id[i]) << 4;
-                i++;
-                uint8 |= (sender_peer_id[i] & '@' ? sender_peer_id[i] + 9 : sender_peer_id[i]) & 0xF;
-                peer_id |= static_cast<uint64_t>(uint8) << shift_by;
-            }
-            auto &peer = ble_connection_tracker.checkSenderInPeers(peer_id);
-            message.setSenderPeer(&peer);
-        }
+std::span<const uint8_t> ProtocolProcessor::decompress(const std::span<const uint8_t> payload,
+                                                       const uint16_t original_size) const {
+    if (original_size == 0 || original_size > decompressed.size() || decompressor == nullptr) {
+        LOG_DEBUG("original size %d not accepted\n", original_size);
+        return {};
     }
-
-    if (message.hasMentions()) {
-        const auto number_of_mentions = reader.read_uint8();
-        for (int i = 0; i < number_of_mentions; i++) {
-            const auto mention_len = reader.read_uint8();
-            const auto mention = reader.read_data(mention_len);
-            if (mention == nullptr) {
-                LOG_DEBUG("Data corrupted: invalid mention\n");
-                return false;
-            }
-            print_named_data("mention", mention, mention_len);
-            message.addMention(std::string(reinterpret_cast<const char *>(mention), mention_len));
-        }
-    }
-
-    if (message.hasChannel()) {
-        const auto channel_len = reader.read_uint8();
-        const auto channel = reader.read_data(channel_len);
-        if (channel == nullptr) {
-            LOG_DEBUG("Data corrupted: invalid channel\n");
-            return false;
-        }
-        print_named_data("channel", channel, channel_len);
-        message.setChannel(std::string(reinterpret_cast<const char *>(channel),
-                                       channel_len));
+    const auto output = decompressed.data();
+    size_t decompressed_size = 0;
+    const auto err = libdeflate_zlib_decompress(decompressor, payload.data(), payload.size(), output, original_size,
+                                                &decompressed_size);
+    if (err != LIBDEFLATE_SUCCESS || decompressed_size != original_size) {
+        LOG_DEBUG("decompressed to something other than the original size - err: %d\n", err);
+        return {};
     }
+    return {output, decompressed_size};
+}
 
-    return true;
+static void print_named_view(const char *name, const std::string_view view) {
+    print_named_data(name, reinterpret_cast<const uint8_t *>(view.data()), view.size());
 }
 
 void ProtocolProcessor::processWrite(BleConnection &connection, const uint16_t offset, const uint8_t *buffer,
                                      const uint16_t buffer_size) const {
-    BinaryReader reader(offset, buffer, buffer_size);
-    if (const auto version = reader.read_uint8(); version != 1) {
-        LOG_DEBUG("Unknown Protocol Version: %d\n", version);
+    PacketView packet;
+    if (!PacketView::parse(buffer, offset, buffer_size, packet)) {
+        if (packet.version != 1) {
+            LOG_DEBUG("Unknown Protocol Version: %d\n", packet.version);
+        } else {
+            LOG_DEBUG("payload not readable\n");
+        }
         return;
     }
-    const auto type = reader.read_uint8();
+    const auto type = packet.type;
+    const auto ttl = packet.ttl;
+    const auto sender = packet.sender;
     LOG_DEBUG("type: %d (%s)\n", type, stringForType(type));
-
-    const auto ttl = reader.read_uint8();
     LOG_DEBUG("ttl: %d\n", ttl);
-    const auto timestamp_ms = reader.read_uint64(); //time in ms since 1970
-    LOG_DEBUG("timestamp: 0x%" PRIx64 "\n", timestamp_ms);
-    const auto packet_flags = reader.read_uint8();
-    LOG_DEBUG("flags: %d\n", packet_flags);
-    auto payload_length = reader.read_uint16();
-    LOG_DEBUG("payload length: %d\n", payload_length);
-    const auto sender = reader.read_uint64();
+    LOG_DEBUG("timestamp: 0x%" PRIx64 "\n", packet.timestamp_ms);
+    LOG_DEBUG("flags: %d\n", packet.flags);
+    LOG_DEBUG("payload length: %zu\n", packet.payload.size());
     LOG_DEBUG("sender: 0x%" PRIx64 "\n", sender);
-    uint64_t recipient = 0;
-    if (packet_flags & packet_flag_has_recipient) {
-        recipient = reader.read_uint64();
-        LOG_DEBUG("recipient: 0x%" PRIx64 "\n", recipient);
+    if (packet.flags & packet_flag_has_recipient) {
+        LOG_DEBUG("recipient: 0x%" PRIx64 "\n", packet.recipient);
     }
-    uint16_t originalSize = 0;
-    if (packet_flags & packet_flag_is_compressed) {
-        //compressed gives original size before payload
-        originalSize = reader.read_uint16();
-        LOG_DEBUG("originalSize: %d\n", originalSize);
-        payload_length -= 2;
-        //removes the two extra chars added to cover these bytes for simpler clients who don't unpack the payload
-    }
-    //payload
-    auto payload = reader.read_data(payload_length);
-
-    std::vector<uint8_t> decompressed;
-    if (payload && packet_flags & packet_flag_is_compressed) {
-        decompressed.reserve(originalSize);
 
-        // Decompress using zlib
-        size_t decompressedSize;
-        const auto d = libdeflate_alloc_decompressor();
-        const auto err = libdeflate_zlib_decompress(d, payload, payload_length, decompressed.data(), originalSize,
-                                                    &decompressedSize);
-        libdeflate_free_decompressor(d);
-
-        if (err == LIBDEFLATE_SUCCESS && decompressedSize > 0) {
-            payload = decompressed.data();
-            payload_length = decompressedSize;
-        }
+    if (!ble_connection_tracker.admitPacket(packet)) {
+        LOG_DEBUG("not admitted\n");
+        return;
+    }
 
-        if (decompressedSize != static_cast<int>(originalSize) || err != LIBDEFLATE_SUCCESS) {
-            LOG_DEBUG("decompressed to something other than the original size - err: %d\n", err);
+    auto payload = packet.payload;
+    //only decompress what gets read here, everything else is relayed as the bytes that arrived
+    const bool read_here = type == type_message || type == type_announce || type == noiseIdentityAnnounce;
+    if (packet.flags & packet_flag_is_compressed && read_here) {
+        LOG_DEBUG("originalSize: %d\n", packet.original_size);
+        payload = decompress(payload, packet.original_size);
+        if (payload.empty()) {
+            return;
         }
-    } else if (payload) {
-        print_named_data("bitchat payload", payload, payload_length);
     } else {
-        LOG_DEBUG("payload not readable\n");
-        return;
+        print_named_data("bitchat payload", payload.data(), payload.size());
     }
-
-    std::string packet_signature;
-    if (packet_flags & packet_flag_has_signature) {
-        constexpr uint8_t signature_length = 64;
-        uint8_t signature[signature_length];
-        memcpy(signature, reader.read_data(signature_length), signature_length);
-        print_named_data("bitchat signature", signature, signature_length);
-        packet_signature.assign(reinterpret_cast<const char *>(signature), signature_length);
+    if (!packet.signature.empty()) {
+        print_named_data("bitchat signature", packet.signature.data(), packet.signature.size());
+    }
+    //a message is checked further before it counts as seen
+    if (type != type_message) {
+        ble_connection_tracker.recordAdmission(packet);
     }
-
-    const auto padding_to_remove = buffer[buffer_size - 1];
-    // LOG_DEBUG("padding_to_remove: %d, pos: %d\n", padding_to_remove, reader.test_only_current_pos());
-    // if (padding_to_remove < buffer_size) {
-    //     print_named_data("bitchat extra data", &buffer[reader.test_only_current_pos()],
-    //                      buffer_size - padding_to_remove);
-    // }
 
     switch (type) {
         case noiseIdentityAnnounce: {
             // Usually has a TTL of 0 so we don't pass these along
-            std::vector<uint8_t> publicKey(payload_length);
-            for (int i = 0; i < payload_length; i++) {
-                publicKey.at(i) = payload[i];
-            }
-            updateOrStorePeerNoisePublicKey(sender, publicKey);
+            updateOrStorePeerNoisePublicKey(sender, std::vector<uint8_t>(payload.begin(), payload.end()));
             break;
         }
         case type_message: {
-            auto &peer = ble_connection_tracker.checkSenderInPeers(sender);
-            if (Message message(ttl, timestamp_ms, packet_flags, sender, recipient, packet_signature);
-                processMessage(message, payload, payload_length)) {
+            MessageView view;
+            if (!MessageView::parse(payload, view)) {
+                LOG_DEBUG("Data corrupted: invalid message of %zu bytes\n", payload.size());
+                ble_connection_tracker.countMessageReject(message_reject_malformed);
+                break;
+            }
+            if (const auto reject = MessageCodec::checkBudget(view); reject != message_reject_count) {
+                LOG_DEBUG("message over budget: %d\n", reject);
+                ble_connection_tracker.countMessageReject(reject);
+                break;
+            }
+            //a stored message has room for an ed25519 signature and nothing longer
+            if (packet.signature.size() > message_signature_size) {
+                ble_connection_tracker.countMessageReject(message_reject_malformed);
+                break;
+            }
+            ble_connection_tracker.recordAdmission(packet);
+            print_named_view("message id", view.message_id);
+            print_named_view("sender", view.sender_nickname);
+            print_named_view("content", view.content);
+            if (ble_connection_tracker.hasMessageWithId(view.message_id)) {
+                break; //seen already, nothing is copied out of the frame
+            }
+            ble_connection_tracker.checkSenderInPeers(sender);
+            if (Message message(ttl, packet.timestamp_ms, packet.flags, sender, packet.recipient, packet.signature);
+                processMessage(message, view)) {
                 if (const auto stored_message = ble_connection_tracker.storeMessageAndReturnIfNew(message)) {
-                    ble_connection_tracker.enqueueBroadcastPacket(stored_message, &connection, &peer);
+                    ble_connection_tracker.enqueueBroadcastPacket(stored_message, &connection, sender);
                 }
             }
             break;
         }
         case type_announce: {
             //store a peer as we might need to pass along a message later
-            std::string peerName;
-            peerName.assign(reinterpret_cast<const char *>(payload), payload_length);
+            const std::string peerName(payload.begin(), payload.end());
             updateOrStorePeerName(sender, peerName, ttl, connection);
-            ble_connection_tracker.possiblyUpdateTimeOffset(timestamp_ms);
+            ble_connection_tracker.possiblyUpdateTimeOffset(packet.timestamp_ms);
             //continue into pass along
         }
         case type_fragment_start:
@@ -321,14 +280,23 @@ void ProtocolProcessor::processWrite(BleConnection &connection, const uint16_t o
                 break;
             }
             //pass along for most types of message
-            auto &peer = ble_connection_tracker.checkSenderInPeers(sender);
-            std::string payloadString;
-            payloadString.assign(reinterpret_cast<const char *>(payload), payload_length);
-            PacketPassAlong pass_along(type, ttl, timestamp_ms, packet_flags, sender, recipient,
-                                       packet_signature);
-            pass_along.setPayload(payloadString);
+            const auto wire_payload = std::string_view(reinterpret_cast<const char *>(packet.payload.data()),
+                                                       packet.payload.size());
+            const auto hash = PacketPassAlong::packetHash(type, packet.flags, packet.timestamp_ms, sender,
+                                                          packet.recipient, wire_payload);
+            if (ble_connection_tracker.hasPacketWithHash(hash)) {
+                break; //seen already, the frame is not copied
+            }
+            ble_connection_tracker.checkSenderInPeers(sender);
+            //the signature and payload stay in the received frame, the one buffer the stored packet owns
+            PacketPassAlong pass_along(type, ttl, packet.timestamp_ms, packet.flags, sender, packet.recipient);
+            pass_along.setReceivedFrame(packet.frame, packet.payload);
             if (const auto stored_packet = ble_connection_tracker.storePacketAndReturnIfNew(pass_along)) {
-                ble_connection_tracker.enqueueBroadcastPacket(stored_packet, &connection, &peer);
+                if (type == type_fragment_start || type == fragmentContinue || type == fragmentEnd) {
+                    ble_connection_tracker.enqueueFragmentPacket(stored_packet, &connection, sender);
+                } else {
+                    ble_connection_tracker.enqueueBroadcastPacket(stored_packet, &connection, sender);
+                }
             }
         }
 
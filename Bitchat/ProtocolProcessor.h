@@ -1,16 +1,27 @@
 #pragma once
 
+#include <span>
 #include <vector>
 
 #include "Message.h"
+#include "PacketView.h"
 #include "../BLE/BleConnection.h"
 #include "../BLE/BleConnectionTracker.h"
 
+struct libdeflate_decompressor;
+
+//Largest payload accepted once decompressed, anything claiming more is dropped before it is decompressed
+constexpr uint16_t max_decompressed_size = 4096;
+
 class ProtocolProcessor {
 public:
-    explicit ProtocolProcessor(BleConnectionTracker &ble_connection_tracker)
-        : ble_connection_tracker(ble_connection_tracker) {
-    }
+    explicit ProtocolProcessor(BleConnectionTracker &ble_connection_tracker);
+
+    ~ProtocolProcessor();
+
+    ProtocolProcessor(const ProtocolProcessor &) = delete;
+
+    ProtocolProcessor &operator=(const ProtocolProcessor &) = delete;
 
     static const char *stringForType(uint8_t type);
 
@@ -18,10 +29,20 @@ public:
 
     void updateOrStorePeerNoisePublicKey(uint64_t sender, const std::vector<uint8_t> &public_key) const;
 
-    bool processMessage(Message &message, const uint8_t *payload, uint16_t payload_length) const;
+    bool processMessage(Message &message, const MessageView &view) const;
 
     void processWrite(BleConnection &connection, uint16_t offset, const uint8_t *buffer, uint16_t buffer_size) const;
 
+    //processes frames waiting in the inbound ring until budget_bytes have been handled, returns how many were
+    size_t processInbound(uint32_t budget_bytes) const;
+
+    //inflates into a buffer owned by the processor, valid until the next call, empty if it isn't exactly original_size
+    [[nodiscard]] std::span<const uint8_t> decompress(std::span<const uint8_t> payload, uint16_t original_size) const;
+
 private:
     BleConnectionTracker &ble_connection_tracker;
+    //allocated once, libdeflate's state is too big to create for every compressed frame
+    libdeflate_decompressor *decompressor;
+    //reused for every frame, sized for the largest payload accepted
+    mutable std::vector<uint8_t> decompressed;
 };
@@ -1,125 +1,214 @@
 #include "int_types.h"
 #include "ProtocolWriter.h"
 
+#include <string_view>
+
 #include "Announce.h"
 #include "BinaryWriter.h"
 #include "BitchatPacketTypes.h"
+#include "FragmentGroup.h"
+#include "MessageCodec.h"
+#include "PacketHash.h"
 #include "PacketPassAlong.h"
+#include "libdeflate.h"
+
+static uint16_t compress_min_saving = 0;
+static uint16_t compress_fit_frame_size = 0;
+//created the first time compression is turned on and kept, level 1 has the smallest state at ~200KB
+static libdeflate_compressor *compressor = nullptr;
 
 void ProtocolWriter::writePacket(std::vector<uint8_t> &vector, const PacketBase *packet_base) {
     if (packet_base == nullptr) {
         return;
     }
+    if (const auto received_frame = packet_base->getReceivedFrame(); received_frame && received_frame->size() > 2) {
+        //passed through untouched apart from the ttl, which stays at the same offset in every version 1 frame
+        vector.assign(received_frame->begin(), received_frame->end());
+        vector[2] = packet_base->getPacketTtl() - 1;
+        return;
+    }
+    const auto type = packet_base->getPacketType();
+    const auto payload_size = payloadSize(packet_base);
+    const auto packet_signature = packet_base->getPacketSignature();
+    const auto packet_signature_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), packet_signature.size()));
+    //version, type, ttl, timestamp, flags, payload length, sender, optional recipient and signature, the zero padding
+    const size_t frame_overhead = 23 + (packet_base->hasPacketRecipient() ? 8 : 0) +
+                                  (packet_base->hasPacketSignature() ? 1 + packet_signature_len : 0);
+    //fragments carry pieces of a frame that has already had its chance to be compressed
+    const bool is_fragment = type == type_fragment_start || type == fragmentContinue || type == fragmentEnd;
+    //only built on its own when it might be compressed, otherwise it is written straight into the frame
+    std::vector<uint8_t> payload;
+    bool compressed = false;
+    if (!is_fragment && compress_min_saving != 0 && payload_size > compress_min_saving) {
+        payload.resize(payload_size);
+        writePayload(payload.data(), packet_base);
+        compressed = compressPayload(payload, frame_overhead);
+    }
+    const auto payload_len = static_cast<uint16_t>(std::min(static_cast<size_t>(65535),
+                                                            payload.empty() ? payload_size : payload.size()));
+    vector.reserve(vector.size() + frame_overhead + payload_len);
     const BinaryWriter writer(vector);
 
     writer.write_uint8(1); //version
-    writer.write_uint8(packet_base->getPacketType());
+    writer.write_uint8(type);
 
     //we only do relaying of packets so if we are writing one we want to reduce the ttl
     writer.write_uint8(packet_base->getPacketTtl()-1);
 
     writer.write_uint64(packet_base->getPacketTimestamp());
-    writer.write_uint8(packet_base->getPacketFlags());
+    //a rebuilt payload is written out uncompressed whatever it arrived as, unless compressing it here paid off
+    writer.write_uint8((packet_base->getPacketFlags() & ~packet_flag_is_compressed) |
+                       (compressed ? packet_flag_is_compressed : 0));
 
-    std::vector<uint8_t> payload;
-    switch (packet_base->getPacketType()) {
-        case type_announce: {
-            if (const auto announce = static_cast<const Announce*>(packet_base); announce != nullptr) {
-                const BinaryWriter payload_writer(payload);
-                payload_writer.write_data(announce->getName(),announce->getName().size());
-            }
-            break;
-        }
-        case type_message: {
-            if (const auto message = static_cast<const Message*>(packet_base); message != nullptr) {
-                writeMessagePayload(payload, *message);
-            }
-            break;
-        }
-        default: {
-            if (const auto pass_along = static_cast<const PacketPassAlong*>(packet_base); pass_along != nullptr) {
-                const BinaryWriter payload_writer(payload);
-                payload_writer.write_data(pass_along->getPayload(),pass_along->getPayload().size());
-            }
-            break;
-        }
-    }
-    const auto payload_len = static_cast<uint16_t>(std::min(static_cast<size_t>(65535), payload.size()));
     writer.write_uint16(payload_len);
     writer.write_uint64(packet_base->getPacketSenderId());
     if (packet_base->hasPacketRecipient()) {
         writer.write_uint64(packet_base->getPacketRecipientId());
     }
 
-    writer.write_data(payload.data(), payload_len);
+    if (payload.empty()) {
+        const auto payload_start = vector.size();
+        vector.resize(payload_start + payload_size);
+        writePayload(vector.data() + payload_start, packet_base);
+        vector.resize(payload_start + payload_len);
+    } else {
+        writer.write_data(payload.data(), payload_len);
+    }
 
     if (packet_base->hasPacketSignature()) {
-        auto &packet_signature = packet_base->getPacketSignature();
-        const auto packet_signature_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), packet_signature.size()));
         writer.write_uint8(packet_signature_len);
-        writer.write_data(packet_signature,packet_signature_len);
+        writer.write_data(packet_signature.data(), packet_signature_len);
     }
 
     writer.write_uint8(0); //Zero padding - We don't believe in the padding other folk add - anyone snooping can just read the messages anyway
 }
 
-void ProtocolWriter::writeMessagePayload(std::vector<uint8_t> &vector, const Message &message) {
-    const BinaryWriter writer(vector);
+size_t ProtocolWriter::payloadSize(const PacketBase *packet_base) {
+    switch (packet_base->getPacketType()) {
+        case type_announce:
+            return static_cast<const Announce *>(packet_base)->getName().size();
+        case type_message:
+            return MessageCodec::encodedSize(*static_cast<const Message *>(packet_base));
+        default:
+            return static_cast<const PacketPassAlong *>(packet_base)->getPayload().size();
+    }
+}
 
-    writer.write_uint8(message.getMessageFlags());
-    writer.write_uint64(message.getMessageTimestamp());
-
-    auto &id = message.getMessageId();
-    const auto id_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), id.size()));
-    writer.write_uint8(id_len);
-    writer.write_data(id,id_len);
-
-    auto &sender = message.getSenderNickname();
-    const auto sender_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), sender.size()));
-    writer.write_uint8(sender_len);
-    writer.write_data(sender,sender_len);
-
-    auto &content = message.getContent();
-    const auto content_len = static_cast<uint16_t>(std::min(static_cast<size_t>(65535), content.size()));
-    writer.write_uint16(content_len);
-    writer.write_data(content,content_len);
-
-    if (message.hasOriginalSender()) {
-        auto &original_sender = message.getOriginalSenderNickname();
-        const auto original_sender_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), original_sender.size()));
-        writer.write_uint8(original_sender_len);
-        writer.write_data(original_sender,original_sender_len);
-    }
-
-    if (message.hasRecipientNickname()) {
-        auto &recipient_nickname = message.getRecipientNickname();
-        const auto recipient_nickname_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), recipient_nickname.size()));
-        writer.write_uint8(recipient_nickname_len);
-        writer.write_data(recipient_nickname,recipient_nickname_len);
-    }
-
-    if (message.hasSenderPeerID()) {
-        const auto peerId = message.getSenderPeer()->getId();
-        constexpr uint8_t size = sizeof(uint64_t)*2;
-        writer.write_uint8(size);
-        writer.write_uint64_hex16(peerId);
-    }
-
-    if (message.hasMentions()) {
-        const auto mentions = message.getMentions();
-        const auto mentions_count = static_cast<uint8_t>(std::min(static_cast<size_t>(255), mentions->size()));
-        writer.write_uint8(mentions_count);
-        for (auto &mention : *mentions) {
-            const auto mention_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), mention.size()));
-            writer.write_uint8(mention_len);
-            writer.write_data(mention,mention_len);
+void ProtocolWriter::writePayload(uint8_t *out, const PacketBase *packet_base) {
+    switch (packet_base->getPacketType()) {
+        case type_announce: {
+            const auto &name = static_cast<const Announce *>(packet_base)->getName();
+            std::copy(name.begin(), name.end(), out);
+            break;
         }
+        case type_message:
+            MessageCodec::encode(*static_cast<const Message *>(packet_base), out);
+            break;
+        default: {
+            const auto payload = static_cast<const PacketPassAlong *>(packet_base)->getPayload();
+            std::copy(payload.begin(), payload.end(), out);
+            break;
+        }
+    }
+}
+
+void ProtocolWriter::setCompression(const uint16_t min_saving, const uint16_t fit_frame_size) {
+    compress_min_saving = min_saving;
+    compress_fit_frame_size = fit_frame_size;
+    if (min_saving > 0 && compressor == nullptr) {
+        compressor = libdeflate_alloc_compressor(1);
+    }
+}
+
+bool ProtocolWriter::compressPayload(std::vector<uint8_t> &payload, const size_t frame_overhead) {
+    if (compress_min_saving == 0 || compressor == nullptr || payload.size() > 0xffff ||
+        payload.size() <= compress_min_saving) {
+        return false;
+    }
+    //original size first, counted in the payload length, then the zlib stream which has to come out smaller
+    std::vector<uint8_t> compressed;
+    const BinaryWriter writer(compressed);
+    writer.write_uint16(payload.size());
+    compressed.resize(payload.size());
+    const auto compressed_size = libdeflate_zlib_compress(compressor, payload.data(), payload.size(),
+                                                          compressed.data() + 2, compressed.size() - 2);
+    if (compressed_size == 0) {
+        return false; //no smaller than it was
+    }
+    compressed.resize(2 + compressed_size);
+    const auto saving = payload.size() - compressed.size();
+    const bool avoids_fragment = frame_overhead + payload.size() > compress_fit_frame_size &&
+                                 frame_overhead + compressed.size() <= compress_fit_frame_size;
+    if (saving < compress_min_saving && !avoids_fragment) {
+        return false;
+    }
+    payload.swap(compressed);
+    return true;
+}
+
+EncodedFrame ProtocolWriter::encodedFrame(const PacketBase *packet_base) {
+    if (packet_base == nullptr) {
+        return {};
     }
+    if (auto &frame = packet_base->getEncodedFrame()) {
+        return frame;
+    }
+    auto frame = std::make_shared<std::vector<uint8_t>>();
+    writePacket(*frame, packet_base);
+    packet_base->setEncodedFrame(frame);
+    return frame;
+}
 
-    if (message.hasChannel()) {
-        auto &channel = message.getChannel();
-        const auto channel_len = static_cast<uint8_t>(std::min(static_cast<size_t>(255), channel.size()));
-        writer.write_uint8(channel_len);
-        writer.write_data(channel,channel_len);
+EncodedFragments ProtocolWriter::encodedFragments(const PacketBase *packet_base, const uint16_t max_frame_size) {
+    if (packet_base == nullptr) {
+        return {};
+    }
+    if (auto fragments = packet_base->getEncodedFragments(max_frame_size)) {
+        return fragments;
     }
+    const auto frame = encodedFrame(packet_base);
+
+    //version, type, ttl, timestamp, flags, payload length, sender, optional recipient and the zero padding
+    const size_t packet_overhead = 23 + (packet_base->hasPacketRecipient() ? 8 : 0);
+    if (max_frame_size <= packet_overhead + fragment_header_size) {
+        return {};
+    }
+    const size_t chunk_size = max_frame_size - packet_overhead - fragment_header_size;
+    const size_t total = (frame->size() + chunk_size - 1) / chunk_size;
+    if (total > 0xffff) {
+        return {};
+    }
+    //derived from the frame rather than random, so the same packet cut the same way gets the same id
+    const uint64_t fragment_id = PacketHasher(max_frame_size).add(std::span(*frame)).finish();
+
+    auto fragments = std::make_shared<std::vector<EncodedFrame>>();
+    fragments->reserve(total);
+    for (size_t index = 0, offset = 0; index < total; index++, offset += chunk_size) {
+        const auto length = std::min(chunk_size, frame->size() - offset);
+        std::vector<uint8_t> fragment_payload;
+        const BinaryWriter payload_writer(fragment_payload);
+        payload_writer.write_uint64(fragment_id);
+        payload_writer.write_uint16(index);
+        payload_writer.write_uint16(total);
+        payload_writer.write_uint8(packet_base->getPacketType());
+        payload_writer.write_data(frame->data() + offset, length);
+
+        const uint8_t type = index == 0 ? type_fragment_start : index == total - 1 ? fragmentEnd : fragmentContinue;
+        PacketPassAlong fragment(type, packet_base->getPacketTtl(), packet_base->getPacketTimestamp(),
+                                 packet_base->getPacketFlags() & packet_flag_has_recipient,
+                                 packet_base->getPacketSenderId(), packet_base->getPacketRecipientId());
+        std::string payload(fragment_payload.begin(), fragment_payload.end());
+        fragment.setPayload(payload);
+        auto fragment_frame = std::make_shared<std::vector<uint8_t>>();
+        writePacket(*fragment_frame, &fragment);
+        fragments->push_back(std::move(fragment_frame));
+    }
+    packet_base->addEncodedFragments(max_frame_size, fragments);
+    return fragments;
+}
+
+void ProtocolWriter::writeMessagePayload(std::vector<uint8_t> &vector, const Message &message) {
+    const auto start = vector.size();
+    vector.resize(start + MessageCodec::encodedSize(message));
+    MessageCodec::encode(message, vector.data() + start);
 }
@@ -8,5 +8,22 @@ class ProtocolWriter {
 public:
     static void writePacket(std::vector<uint8_t> &vector, const PacketBase *packet_base);
 
+    static EncodedFrame encodedFrame(const PacketBase *packet_base);
+
+    //empty if the frame can't be split into fragments that fit max_frame_size
+    static EncodedFragments encodedFragments(const PacketBase *packet_base, uint16_t max_frame_size);
+
     static void writeMessagePayload(std::vector<uint8_t> &vector, const Message &message);
+
+    //rebuilt payloads go out compressed when that saves at least min_saving bytes, or brings the frame down to
+    //fit_frame_size so it needn't be fragmented, a min_saving of 0 turns compression off
+    static void setCompression(uint16_t min_saving, uint16_t fit_frame_size);
+
+private:
+    static size_t payloadSize(const PacketBase *packet_base);
+
+    //writes exactly payloadSize(packet_base) bytes from out
+    static void writePayload(uint8_t *out, const PacketBase *packet_base);
+
+    static bool compressPayload(std::vector<uint8_t> &payload, size_t frame_overhead);
 };
@@ -33,6 +33,8 @@
 
 const uint EXIT_GPIO_PIN = 28;
 const uint LIFE_CHECK_PIN = 18;
+const uint32_t led_flash_us = 20 * 1000;
+const uint32_t idle_wait_us = 40 * 1000;
 
 
 #define BLE_SCAN_PERIOD_MS 2000
@@ -140,7 +142,12 @@ int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle,
             default:
                 break;
         }
-        return 0;
+        //only the bitchat characteristic takes long writes, the execute and cancel don't say which handle they are for
+        if (transaction_mode == ATT_TRANSACTION_MODE_ACTIVE &&
+            att_handle != ATT_CHARACTERISTIC_A1B2C3D4_E5F6_4A5B_8C9D_0E1F2A3B4C5D_01_VALUE_HANDLE) {
+            return 0;
+        }
+        return connection_tracker.receiveWrite(connection_handle, transaction_mode, offset, buffer, buffer_size);
     }
     auto &context = connection_tracker.connectionForConnHandle(connection_handle);
 
@@ -163,7 +170,8 @@ int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle,
         case ATT_CHARACTERISTIC_A1B2C3D4_E5F6_4A5B_8C9D_0E1F2A3B4C5D_01_VALUE_HANDLE: {
             LOG_DEBUG("write from a bitchat connection - offset: %d, buffer_size: %d\n", offset, buffer_size);
             //print_named_data("att write buffer in", buffer, buffer_size);
-            processor.processWrite(context, offset, buffer, buffer_size);
+            //copied out and processed from the main loop
+            connection_tracker.receiveWrite(connection_handle, transaction_mode, offset, buffer, buffer_size);
             break;
         }
         default:
@@ -512,9 +520,8 @@ void handle_gatt_client_value_update_event(uint8_t packet_type, uint16_t channel
             auto value_handle = gatt_event_notification_get_value_handle(packet);
             auto value_length = gatt_event_notification_get_value_length(packet);
             auto value = gatt_event_notification_get_value(packet);
-            auto connection = connection_tracker.connectionForConnHandle(handle);
             LOG_DEBUG("handle 0x%x, %d, %d, %d, %d\n", handle, service_id, connection_id, value_handle, value_length);
-            processor.processWrite(connection, 0, value, value_length);
+            connection_tracker.getInboundRing().push(handle, value, value_length);
             break;
         }
         case GATT_EVENT_INDICATION: {
@@ -697,7 +704,16 @@ void hci_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet,
             }
             break;
         }
-        case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS: //0x13
+        case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS: {
+            //0x13 - returns the acl buffer credits used by burst sending
+            const uint8_t num_handles = packet[2];
+            for (uint8_t i = 0, offset = 3; i < num_handles; i++, offset += 4) {
+                const hci_con_handle_t con_handle = little_endian_read_16(packet, offset) & 0x0fff;
+                const uint16_t completed = little_endian_read_16(packet, offset + 2);
+                connection_tracker.reportPacketsCompleted(con_handle, completed);
+            }
+            break;
+        }
         case HCI_EVENT_TRANSPORT_PACKET_SENT: //0x6e
             //ignore
             break;
@@ -728,6 +744,14 @@ void att_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet,
             // hci_connection_t *hci_connection = hci_connection_for_handle(con_handle);
             // LOG_DEBUG("hci_connection_for_handle(0x%x) - 0x%x\n",con_handle,hci_connection);
             break;
+        case ATT_EVENT_MTU_EXCHANGE_COMPLETE: {
+            //peripheral links learn their MTU here, central links from GATT_EVENT_MTU
+            const auto con_handle = att_event_mtu_exchange_complete_get_handle(packet);
+            BleConnection &connection = connection_tracker.connectionForConnHandle(con_handle);
+            connection.setMtu(att_event_mtu_exchange_complete_get_MTU(packet));
+            LOG_DEBUG("ATT MTU: %d\n", att_event_mtu_exchange_complete_get_MTU(packet));
+            break;
+        }
         case ATT_EVENT_CONNECTED: {
             //0xb3
             //att_packet:b30901 8a91a10fea5a 4000
@@ -797,7 +821,6 @@ bool connect_to_first_neighbour() {
             connection_in_progress = true;
             return true;
         }
-        sleep_ms(20);
     }
     return false;
 }
@@ -855,7 +878,7 @@ void handlePinActivity() {
         name_writer.write_uint8_hex16(local_addr[BD_ADDR_LEN - 1]);
         message.setSenderNickname(std::string(reinterpret_cast<const char *>(name_buffer.data()), name_buffer.size()));
 
-        if (const Message *messageIfNew = connection_tracker.storeMessageAndReturnIfNew(message)) {
+        if (const auto messageIfNew = connection_tracker.storeMessageAndReturnIfNew(message)) {
             //our messages will always be new
             connection_tracker.enqueueBroadcastPacket(messageIfNew);
             global_activity++;
@@ -885,6 +908,9 @@ int main() {
     //reduce_clock(18); //Meshtastic folk have managed to get things working this slow
 #if (PICO_RP2040)
     reduce_clock(63); //slower than this and things get funky in CYW43 land
+#else
+    //the compressor needs ~200KB which only the rp2350 can spare, 182 is the frame size of a 185 byte mtu
+    ProtocolWriter::setCompression(16, 182);
 #endif
     stdio_init_all();
 
@@ -943,10 +969,10 @@ int main() {
     auto lastSleepOrActivity = time_us_32();
     auto lastAnnounce = time_us_32();
     uint32_t lastFlash = 0;
+    bool led_on = false;
     auto lastScan = time_us_32();
     auto lastRssiUpdate = time_us_32();
     bool rssi_update_in_progress = false;
-    auto lastCleanup = time_us_32() + five_minutes_in_us; //gives 15mins before first cleanup
     auto last_activity = global_activity;
     while (keep_running) {
         const auto loopStart = time_us_32();
@@ -954,6 +980,7 @@ int main() {
         handlePinActivity();
         if ((loopStart - lastAnnounce) > two_seconds_in_us) {
             connection_tracker.announceToConnections();
+            connection_tracker.expireFragmentGroups();
             printAvailableLogging();
             lastAnnounce = time_us_32();
         }
@@ -971,14 +998,19 @@ int main() {
             connection_tracker.printStats();
         }
         printAvailableLogging();
+        processor.processInbound(inbound_drain_budget_bytes);
+        printAvailableLogging();
         connection_tracker.sendPackets();
         printAvailableLogging();
+        connection_tracker.advanceExpiry(expiry_work_budget);
 
         if ((loopStart - lastFlash) > two_seconds_in_us) {
             cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, true);
-            sleep_ms(20);
-            cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
+            led_on = true;
             lastFlash = time_us_32();
+        } else if (led_on && (loopStart - lastFlash) > led_flash_us) {
+            cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
+            led_on = false;
         }
         if ((loopStart - lastRssiUpdate) > five_minutes_in_us) {
             rssi_update_in_progress = connection_tracker.requestNextRssi(true);
@@ -990,14 +1022,11 @@ int main() {
             start_scanning_for_local_nodes();
             lastScan = time_us_32();
         }
-        if ((loopStart - lastCleanup) > ten_minutes_in_us) {
-            connection_tracker.cleanupStaleItems();
-            lastCleanup = time_us_32();
-        }
 
         bool slept = false;
         //nothing happened in the last 2seconds so lets sleep
-        while ((loopStart - lastSleepOrActivity) > two_seconds_in_us && last_activity == global_activity) {
+        while ((loopStart - lastSleepOrActivity) > two_seconds_in_us && last_activity == global_activity &&
+               connection_tracker.getInboundRing().empty()) {
             connection_tracker.printStats();
             LOG_DEBUG("We can sleep\n");
             printAvailableLogging();
@@ -1022,8 +1051,9 @@ int main() {
             lastSleepOrActivity = time_us_32();
             last_activity = global_activity;
         }
-        if (!slept) {
-            sleep_ms(40);
+        if (!slept && connection_tracker.getInboundRing().empty()) {
+            //sends are driven by the btstack can-send callbacks, so only wait until the next event or timeout
+            best_effort_wfe_or_timeout(make_timeout_time_us(idle_wait_us));
         }
     }
 }
@@ -0,0 +1,43 @@
+/*
+ * SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+size_t allocation_count = 0;
+size_t allocation_bytes = 0;
+
+//every form of new and delete is replaced together, so whatever a delete is handed came from the malloc below
+void *operator new(const size_t size) {
+    allocation_count++;
+    allocation_bytes += size;
+    if (void *allocated = std::malloc(size ? size : 1)) {
+        return allocated;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](const size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void *allocated) noexcept {
+    std::free(allocated);
+}
+
+void operator delete[](void *allocated) noexcept {
+    ::operator delete(allocated);
+}
+
+void operator delete(void *allocated, size_t) noexcept {
+    ::operator delete(allocated);
+}
+
+void operator delete[](void *allocated, size_t) noexcept {
+    ::operator delete(allocated);
+}
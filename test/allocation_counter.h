@@ -0,0 +1,16 @@
+/*
+ * SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstddef>
+
+//Heap allocations made through the global operator new since the tests started, so a test can show what it avoids
+extern size_t allocation_count;
+extern size_t allocation_bytes;
+
+#endif //ALLOCATION_COUNTER_H
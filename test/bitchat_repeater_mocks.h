@@ -92,6 +92,22 @@ typedef struct {
 } gatt_client_notification_t;
 
 #define ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER                      0x02u
+#define BTSTACK_ACL_BUFFERS_FULL                                      0x57u
+
+// values from btstack_config.h
+#define MAX_NR_HCI_CONNECTIONS 6
+#define MAX_NR_CONTROLLER_ACL_BUFFERS 3
+#define HCI_HOST_ACL_PACKET_LEN (517+4)
+#define HCI_HOST_ACL_PACKET_NUM 3
+
+// values from att_db.h and bluetooth.h
+#define ATT_TRANSACTION_MODE_NONE      0x0
+#define ATT_TRANSACTION_MODE_ACTIVE    0x1
+#define ATT_TRANSACTION_MODE_EXECUTE   0x2
+#define ATT_TRANSACTION_MODE_CANCEL    0x3
+#define ATT_TRANSACTION_MODE_VALIDATE  0x4
+#define ATT_ERROR_INVALID_OFFSET                   0x07
+#define ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH   0x0d
 
 void gatt_client_stop_listening_for_characteristic_value_updates(gatt_client_notification_t * notification);
 
@@ -112,3 +128,4 @@ inline char * bd_addr_to_str(const bd_addr_t addr) {
 	return nullptr;
 }
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle);
+int hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle);
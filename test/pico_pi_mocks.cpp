@@ -5,6 +5,9 @@
  */
 
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <map>
+#include <ranges>
 #include <vector>
 #include <cstring>
 
@@ -13,6 +16,9 @@
 #include "pico_pi_mocks.h"
 
 #include "../Bitchat/BinaryWriter.h"
+#include "../BLE/BleConnectionTracker.h"
+
+extern BleConnectionTracker *connection_tracker_ptr;
 
 int lastAddress;
 int last_length_read;
@@ -86,6 +92,10 @@ void sleep_ms(int ms) {
 	waitTime += ms*1000;
 }
 
+int get_wait_time_for_test() {
+	return waitTime;
+}
+
 void set_mock_time(const uint64_t now) {
 	mock_now = now;
 }
@@ -166,24 +176,80 @@ hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle) {
 	return nullptr;
 }
 
-uint8_t att_server_request_to_send_notification(btstack_context_callback_registration_t * callback_registration, hci_con_handle_t con_handle) {
-	callback_registration->callback(callback_registration->context);
+std::map<hci_con_handle_t, uint16_t> mock_in_flight;
+
+void complete_in_flight_packets() {
+	for (const auto &[con_handle, count]: mock_in_flight) {
+		if (connection_tracker_ptr) {
+			connection_tracker_ptr->reportPacketsCompleted(con_handle, count);
+		}
+	}
+	mock_in_flight.clear();
+}
+
+bool mock_defer_can_send = false;
+std::vector<btstack_context_callback_registration_t *> mock_pending_can_send;
+
+int hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle) {
+	int in_flight = 0;
+	for (const auto count: mock_in_flight | std::views::values) {
+		in_flight += count;
+	}
+	return MAX_NR_CONTROLLER_ACL_BUFFERS - in_flight;
+}
+
+static uint8_t request_can_send(btstack_context_callback_registration_t * callback_registration) {
+	if (!mock_defer_can_send) {
+		// called back straight away, as if the controller had already sent everything handed to it
+		mock_in_flight.clear();
+		callback_registration->callback(callback_registration->context);
+		return 0;
+	}
+	// btstack keeps registrations in a linked list, adding one that is already waiting is a no-op
+	if (std::ranges::find(mock_pending_can_send, callback_registration) == mock_pending_can_send.end()) {
+		mock_pending_can_send.push_back(callback_registration);
+	}
 	return 0;
 }
 
+size_t pending_can_send_count() {
+	return mock_pending_can_send.size();
+}
+
+void run_pending_can_send() {
+	auto pending = std::move(mock_pending_can_send);
+	mock_pending_can_send.clear();
+	for (const auto registration: pending) {
+		registration->callback(registration->context);
+		// the connection event carries whatever was handed over, freeing the controller buffers again
+		complete_in_flight_packets();
+	}
+}
+
+uint8_t att_server_request_to_send_notification(btstack_context_callback_registration_t * callback_registration, hci_con_handle_t con_handle) {
+	return request_can_send(callback_registration);
+}
+
 uint8_t gatt_client_request_to_write_without_response(btstack_context_callback_registration_t * callback_registration, hci_con_handle_t con_handle) {
-	callback_registration->callback(callback_registration->context);
-	return 0;
+	return request_can_send(callback_registration);
 }
 
 uint8_t att_server_notify(hci_con_handle_t con_handle, uint16_t attribute_handle, const uint8_t *value, uint16_t value_len) {
+	if (hci_number_free_acl_slots_for_handle(con_handle) <= 0) {
+		return BTSTACK_ACL_BUFFERS_FULL;
+	}
 	BinaryWriter writer(mock_sent_data);
 	writer.write_data(value,value_len);
+	mock_in_flight[con_handle]++;
 	return 0;
 }
 
 uint8_t gatt_client_write_value_of_characteristic_without_response(hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * value) {
+	if (hci_number_free_acl_slots_for_handle(con_handle) <= 0) {
+		return BTSTACK_ACL_BUFFERS_FULL;
+	}
 	BinaryWriter writer(mock_sent_data);
 	writer.write_data(value,value_length);
+	mock_in_flight[con_handle]++;
 	return 0;
 }
@@ -31,6 +31,7 @@ int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t
 void sleep_us(int us);
 void sleep_ms(int ms);
 void set_mock_time(uint64_t now);
+int get_wait_time_for_test();
 uint64_t time_us_64();
 
 uint32_t save_and_disable_interrupts();
@@ -39,5 +40,12 @@ void restore_interrupts(uint32_t status);
 void reset_sent_for_test();
 extern std::vector<uint8_t> mock_sent_data;
 
+// When set, can-send requests are held (as BTstack would) until run_pending_can_send() is called
+extern bool mock_defer_can_send;
+size_t pending_can_send_count();
+void run_pending_can_send();
+// Reports every frame sent since the last call as completed by the controller
+void complete_in_flight_packets();
+
 
 #endif // PICO_PI_MOCKS_H
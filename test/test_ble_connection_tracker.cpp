@@ -5,15 +5,30 @@
  */
 
 #include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cinttypes>
 #include <cstdarg>
 #include <cstdint>
 #include <cstring>
+#include <map>
+#include <malloc.h>
 #include <vector>
 
+#include "Debugging.h"
 #include "pico_pi_mocks.h"
+#include "allocation_counter.h"
+#include "tracker_test_helpers.h"
+#include "libdeflate.h"
 #include "../Bitchat/BinaryReader.h"
 #include "../Bitchat/BinaryWriter.h"
 #include "../Bitchat/ProtocolProcessor.h"
+#include "../Bitchat/ProtocolWriter.h"
+#include "../Bitchat/FragmentGroup.h"
+#include "../Bitchat/MessageCodec.h"
+#include "../Bitchat/PacketPassAlong.h"
+#include "../Bitchat/PacketView.h"
+#include "../BLE/ExpiryWheel.h"
+#include "../BLE/MemoryBudget.h"
 
 const uint8_t uint_array1[] = {
     0x01, 0x01, 0x03, 0x00, 0x00, 0x01, 0x98, 0x71, 0x83, 0xcd, 0xf9, 0x00, 0x00, 0x04, 0x1d, 0x3d, 0x6a, 0x26, 0x15,
@@ -33,7 +48,6 @@ const std::string noise_encrypted1 =
     "01120700000198d284504b010114e74da1a856b690936ff9f65a6858d8ff000000006ee544eddd2b060d5b628002aed065491fc8b706ccbfafc518aedba00f4bf4d807d79cbcd1d32b8bc1fcb280781a22a2d6ea4814ed32dab76258a74cc695fb79fb520f1f020df4014888cb63d47c25de594c1ca4d76be437a87dec399c12c6d5473d2f44981d88e6f196c91292ecde587b7f2187c129b77b9947b0a48526c201b297204a9d8123f90e4abaa011aef35a93483957634a01d57b495f5dcbeb86d772eaa326575383c15482ddbfd84ce429d6f4390544fc56d55a3c966cecbf76c4837c3078fca2c5258ee7446987d10716b0c6c3233aad4b3f4d17";
 const std::string noise_encrypted2 =
     "01120700000198d35e50ee0100861a4d912f6a99af5e6ff9f65a6858d8ff00000000a2973fc96e96acb6176fa9b4aa81f65b44d96e0d0c6956a1a22ab637ed4e2587d63f6490bac66e3b4b08ea6317574d6797132c28cf6b2f2587e62746f7db631a7410eca33be8d35ed6d20cdb56fde7b10bbe1387b274dd02df3c8708f2288943ed3aa0c5a9b14900ecfe87a02c4ef6fce1e849353a8d2a7032ca33ce1666a2ab672200";
-BleConnectionTracker *connection_tracker_ptr=nullptr;
 
 TEST_CASE("ProtocolProcessorAnnounce", "[data2]") {
     const uint8_t data_len = data2.length() / 2;
@@ -140,7 +154,7 @@ TEST_CASE("ProtocolProcessorMessageAdam", "[data6]") {
 
     REQUIRE("adam" == message->getSenderNickname());
     REQUIRE("hello" == message->getContent());
-    REQUIRE(0xc67ff7caf2952326 == message->getSenderPeer()->getId());
+    REQUIRE(0xc67ff7caf2952326 == message->getSenderPeerId());
 
     Peer &newPeerToSendTo = tracker.checkSenderInPeers(0x23789453);
     REQUIRE(0x23789453 == newPeerToSendTo.getId());
@@ -318,4 +332,1558 @@ TEST_CASE("AnnounceOnlyOnceNoSendCleanup","[Ann2]") {
     tracker.cleanupStaleItems();
     REQUIRE(0 == tracker.getTargetedPacketsToSendSize());
 
-}
\ No newline at end of file
+}
+TEST_CASE("EncodedFrameSharedAcrossConnections", "[frame1]") {
+    const uint8_t data_len = data6.length() / 2;
+    uint8_t uint_array[data_len];
+    populate_array_from_string(uint_array, data6);
+
+    size_t single_frame_bytes = 0;
+    for (hci_con_handle_t fan_out = 1; fan_out <= 6; fan_out++) {
+        TrackerUnderTest under_test;
+        auto &[tracker, processor] = under_test;
+        for (hci_con_handle_t handle = 1; handle <= fan_out; handle++) {
+            connectedLink(tracker, handle, 517);
+        }
+        BleConnection &connection_from = connectedLink(tracker, 0x40, 517);
+
+        processor.processWrite(connection_from, 0, uint_array, sizeof(uint_array));
+
+        mock_defer_can_send = true;
+        tracker.sendPackets();
+        if (fan_out == 1) {
+            single_frame_bytes = tracker.getQueuedFrameBytes();
+            REQUIRE(106 == single_frame_bytes);
+        }
+        //every connection queue points at the one encoded frame
+        REQUIRE(single_frame_bytes == tracker.getQueuedFrameBytes());
+
+        reset_sent_for_test();
+        while (pending_can_send_count() > 0) {
+            run_pending_can_send();
+        }
+        mock_defer_can_send = false;
+    }
+}
+
+TEST_CASE("BurstOf100PacketsDoesNotBlock", "[send1]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    connectedLink(tracker, 1, 517);
+
+    constexpr uint64_t start_us = 1000 * 1000;
+    constexpr uint64_t connection_interval_us = 7500;
+    set_mock_time(start_us);
+    enqueueBurst(tracker, 100, "burst payload");
+
+    mock_defer_can_send = true;
+    reset_sent_for_test();
+    const auto waited_before = get_wait_time_for_test();
+    tracker.sendPackets();
+    //the main loop hands the burst over without sleeping, btstack pulls it out as connection events happen
+    REQUIRE(waited_before == get_wait_time_for_test());
+    REQUIRE(mock_sent_data.empty());
+
+    uint64_t now = start_us;
+    while (pending_can_send_count() > 0) {
+        now += connection_interval_us;
+        set_mock_time(now);
+        run_pending_can_send();
+    }
+    mock_defer_can_send = false;
+
+    const auto latency_us = now - start_us;
+    LOG_DEBUG("100 packet burst latency: %" PRIu64 "us\n", latency_us);
+    REQUIRE(0 == tracker.getQueuedFrameBytes());
+    //with the old fixed sleep the main loop alone was stalled for 100 * 20ms
+    REQUIRE(latency_us <= 100 * connection_interval_us);
+    REQUIRE(latency_us < 100 * 20 * 1000);
+    set_mock_time(0);
+}
+
+TEST_CASE("AllConnectionsDrainConcurrently", "[send2]") {
+    constexpr uint64_t burst = 20;
+    size_t previous_frames_per_round = 0;
+    for (hci_con_handle_t connection_count = 1; connection_count <= 6; connection_count++) {
+        TrackerUnderTest under_test;
+        auto &tracker = under_test.tracker;
+        for (hci_con_handle_t handle = 1; handle <= connection_count; handle++) {
+            BleConnection &connection_to = connectedLink(tracker, handle, 517);
+            //mix of peripheral (notify) and central (write without response) links
+            connection_to.setRole(handle % 2 ? HCI_ROLE_SLAVE : HCI_ROLE_MASTER);
+        }
+        enqueueBurst(tracker, burst, "concurrent payload");
+
+        mock_defer_can_send = true;
+        reset_sent_for_test();
+        tracker.sendPackets();
+        REQUIRE(connection_count == pending_can_send_count());
+
+        size_t connection_events = 0;
+        while (pending_can_send_count() > 0) {
+            run_pending_can_send();
+            connection_events++;
+        }
+        mock_defer_can_send = false;
+
+        const auto frame_size = mock_sent_data.size() / (burst * connection_count);
+        const auto frames_per_round = mock_sent_data.size() / frame_size / connection_events;
+        LOG_DEBUG("connections: %d, events: %zu, frames per event: %zu\n", connection_count, connection_events,
+                  frames_per_round);
+        REQUIRE(0 == tracker.getQueuedFrameBytes());
+        REQUIRE(mock_sent_data.size() == frame_size * burst * connection_count);
+        //every link drains in parallel so aggregate throughput scales with the number of links
+        REQUIRE(frames_per_round >= previous_frames_per_round + 1);
+        REQUIRE((burst + MAX_NR_CONTROLLER_ACL_BUFFERS - 1) / MAX_NR_CONTROLLER_ACL_BUFFERS == connection_events);
+        previous_frames_per_round = frames_per_round;
+    }
+}
+
+TEST_CASE("BurstModeUsesControllerCredits", "[send3]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    BleConnection &connection_to = connectedLink(tracker, 1, 517);
+    connection_to.setRole(HCI_ROLE_SLAVE);
+
+    enqueueBurst(tracker, 30, "burst mode payload");
+
+    mock_defer_can_send = true;
+    reset_sent_for_test();
+    tracker.sendPackets();
+
+    //one connection event takes as many frames as there are controller buffers
+    run_pending_can_send();
+    const auto frame_size = mock_sent_data.size() / MAX_NR_CONTROLLER_ACL_BUFFERS;
+    REQUIRE(MAX_NR_CONTROLLER_ACL_BUFFERS * frame_size == mock_sent_data.size());
+
+    size_t connection_events = 1;
+    while (pending_can_send_count() > 0) {
+        run_pending_can_send();
+        connection_events++;
+    }
+    mock_defer_can_send = false;
+
+    REQUIRE(30 * frame_size == mock_sent_data.size());
+    REQUIRE(30 / MAX_NR_CONTROLLER_ACL_BUFFERS == connection_events);
+    REQUIRE(static_cast<float>(MAX_NR_CONTROLLER_ACL_BUFFERS) == tracker.getPacketsPerConnectionEvent());
+    REQUIRE(0 == connection_to.getPacketsInFlight());
+}
+
+TEST_CASE("DeliveredMaskSlotReuse", "[slot1]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    BleConnection &connection_from = connectedLink(tracker, 1, 517);
+    BleConnection &connection_to = connectedLink(tracker, 2, 517);
+
+    auto pass_along = passAlong(0, "slot payload");
+    const auto stored_handle = tracker.storePacketAndReturnIfNew(pass_along);
+    REQUIRE(stored_handle);
+    const auto stored = tracker.packetForHandle(stored_handle);
+    tracker.enqueueBroadcastPacket(stored_handle, &connection_from, 0x1a4d912f6a99af5e);
+    REQUIRE(stored->isDeliveredTo(connection_from.getSlot()));
+    REQUIRE(!stored->isDeliveredTo(connection_to.getSlot()));
+
+    reset_sent_for_test();
+    tracker.sendPackets();
+    const auto frame_size = mock_sent_data.size();
+    REQUIRE(frame_size > 0);
+    REQUIRE(stored->isDeliveredTo(connection_to.getSlot()));
+
+    //the slot is handed back on disconnect, a new link reusing it must not inherit the delivery
+    const auto slot = connection_to.getSlot();
+    tracker.reportDisconnection(2);
+    REQUIRE(no_connection_slot == connection_to.getSlot());
+    REQUIRE(!stored->isDeliveredTo(slot));
+    BleConnection &connection_new = connectedLink(tracker, 3, 517);
+    REQUIRE(slot == tracker.connectionSlot(connection_new));
+
+    reset_sent_for_test();
+    tracker.enqueueBroadcastPacket(stored_handle);
+    tracker.sendPackets();
+    REQUIRE(frame_size == mock_sent_data.size());
+    REQUIRE(stored->isDeliveredTo(connection_new.getSlot()));
+}
+
+TEST_CASE("LinksBeyondTheSlotsAreNotSent", "[slot3]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    tracker.possiblyUpdateTimeOffset(build_time_ms + 1000); //announces wait for the clock to be set
+    for (hci_con_handle_t handle = 1; handle <= MAX_NR_HCI_CONNECTIONS + 1; handle++) {
+        connectedLink(tracker, handle, 517);
+    }
+    const auto &slotless = tracker.connectionForConnHandle(MAX_NR_HCI_CONNECTIONS + 1);
+
+    auto pass_along = passAlong(0, "slot payload");
+    const auto stored = tracker.storePacketAndReturnIfNew(pass_along);
+    tracker.enqueueBroadcastPacket(stored);
+    reset_sent_for_test();
+    tracker.sendPackets();
+    REQUIRE(no_connection_slot == slotless.getSlot());
+    REQUIRE(slotless.getTxQueue().empty());
+    const auto frame_size = ProtocolWriter::encodedFrame(tracker.packetForHandle(stored))->size();
+    REQUIRE(MAX_NR_HCI_CONNECTIONS * frame_size == mock_sent_data.size());
+
+    //nothing goes again on later passes, to the slotless link or any other
+    for (int pass = 0; pass < 3; pass++) {
+        tracker.enqueueBroadcastPacket(stored);
+        tracker.sendPackets();
+    }
+    REQUIRE(slotless.getTxQueue().empty());
+    REQUIRE(MAX_NR_HCI_CONNECTIONS * frame_size == mock_sent_data.size());
+
+    //the announce goes once to each link with a slot and isn't queued for the one without
+    tracker.announceToConnections();
+    REQUIRE(MAX_NR_HCI_CONNECTIONS == tracker.getTargetedPacketsToSendSize());
+    tracker.sendPackets();
+    tracker.announceToConnections();
+    REQUIRE(0 == tracker.getTargetedPacketsToSendSize());
+    REQUIRE(slotless.getTxQueue().empty());
+}
+
+TEST_CASE("DeliveredCheckBenchmark", "[slot2]") {
+    constexpr size_t packet_count = 1000;
+    constexpr hci_con_handle_t connection_count = MAX_NR_HCI_CONNECTIONS;
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    std::vector<BleConnection *> links;
+    for (hci_con_handle_t handle = 1; handle <= connection_count; handle++) {
+        auto &connection = tracker.connectionForConnHandle(handle);
+        connection.setConnected(true);
+        tracker.connectionSlot(connection);
+        links.push_back(&connection);
+    }
+    //more packets than the tracker's pool holds, it is only the delivered check being measured
+    std::vector<PacketPassAlong> packets;
+    packets.reserve(packet_count);
+    std::vector<const PacketPassAlong *> stored;
+    for (uint64_t i = 0; i < packet_count; i++) {
+        stored.push_back(&packets.emplace_back(passAlong(i, "benchmark payload")));
+    }
+
+    //the per delivery bookkeeping that was replaced, one node allocated for every packet and connection pair
+    std::multimap<const PacketBase *, const BleConnection *> sent_list;
+    for (size_t i = 0; i < stored.size(); i++) {
+        for (hci_con_handle_t c = 0; c < connection_count; c += 1 + i % 2) {
+            sent_list.emplace(stored[i], links[c]);
+            stored[i]->markDeliveredTo(links[c]->getSlot());
+        }
+    }
+
+    size_t multimap_sendable = 0;
+    const auto multimap_start = std::chrono::steady_clock::now();
+    for (const auto packet: stored) {
+        for (const auto connection: links) {
+            bool sendable = true;
+            const auto [sent_begin, sent_end] = sent_list.equal_range(packet);
+            for (auto search = sent_begin; search != sent_end; ++search) {
+                if (search->second->getConnectionHandle() == connection->getConnectionHandle()) {
+                    sendable = false;
+                }
+            }
+            multimap_sendable += sendable;
+        }
+    }
+    const auto multimap_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - multimap_start).count();
+
+    size_t mask_sendable = 0;
+    const auto mask_start = std::chrono::steady_clock::now();
+    for (const auto packet: stored) {
+        for (const auto connection: links) {
+            mask_sendable += !packet->isDeliveredTo(connection->getSlot());
+        }
+    }
+    const auto mask_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - mask_start).count();
+
+    LOG_DEBUG("delivered check over %zu packets x %d connections - multimap: %" PRId64 "ns (%zu nodes), mask: %"
+              PRId64 "ns (0 nodes)\n", packet_count, connection_count, static_cast<int64_t>(multimap_ns),
+              sent_list.size(), static_cast<int64_t>(mask_ns));
+    REQUIRE(multimap_sendable == mask_sendable);
+    REQUIRE(packet_count * connection_count / 4 == mask_sendable);
+}
+
+TEST_CASE("ControlFramesOvertakeBulkBacklog", "[tx1]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    tracker.possiblyUpdateTimeOffset(1755685519000);
+    BleConnection &connection_to = connectedLink(tracker, 1, 517);
+    connection_to.setRole(HCI_ROLE_SLAVE);
+
+    enqueueBurst(tracker, 20, "bulk backlog payload");
+    mock_defer_can_send = true;
+    reset_sent_for_test();
+    tracker.sendPackets();
+    //the announce is queued behind the whole encrypted backlog but goes out in the first connection event
+    tracker.announceToConnections();
+    tracker.sendPackets();
+    run_pending_can_send();
+    REQUIRE(mock_sent_data.size() > 2);
+    REQUIRE(type_announce == mock_sent_data[1]);
+    while (pending_can_send_count() > 0) {
+        run_pending_can_send();
+    }
+    mock_defer_can_send = false;
+
+    REQUIRE(1 == tracker.getTxWaitStats(tx_class_control).count);
+    REQUIRE(0 == tracker.getTxWaitStats(tx_class_normal).count);
+    REQUIRE(20 == tracker.getTxWaitStats(tx_class_bulk).count);
+    tracker.printStats();
+}
+
+TEST_CASE("DeficitRoundRobinSharesBytes", "[tx2]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    std::vector<BleConnection *> links;
+    for (hci_con_handle_t handle = 1; handle <= 2; handle++) {
+        auto &connection = connectedLink(tracker, handle, 517);
+        connection.setRole(HCI_ROLE_SLAVE);
+        links.push_back(&connection);
+    }
+    auto enqueue = [&](BleConnection *connection, const uint64_t index, const size_t payload_size) {
+        if (const auto stored = storePassAlong(tracker, index, std::string(payload_size, 'x'))) {
+            tracker.enqueueTargetedPacket(stored, connection);
+        }
+    };
+    for (uint64_t i = 0; i < 6; i++) {
+        enqueue(links[0], i, 480);
+        enqueue(links[1], 100 + i, 20);
+    }
+
+    mock_defer_can_send = true;
+    reset_sent_for_test();
+    tracker.sendPackets();
+    //the link with large frames gets one quantum of bytes per round, not every controller buffer
+    run_pending_can_send();
+    const auto first_round = mock_sent_data.size();
+    const auto large = passAlong(0, std::string(480, 'x'));
+    const auto large_frame = ProtocolWriter::encodedFrame(&large)->size();
+    REQUIRE(first_round < 2 * large_frame);
+    REQUIRE(first_round > large_frame);
+    size_t rounds = 1;
+    while (pending_can_send_count() > 0) {
+        run_pending_can_send();
+        rounds++;
+    }
+    mock_defer_can_send = false;
+    REQUIRE(6 == rounds);
+    REQUIRE(0 == tracker.getQueuedFrameBytes());
+}
+
+TEST_CASE("StalledPeerQueueStaysBounded", "[tx3]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    tracker.possiblyUpdateTimeOffset(1755685519000);
+    BleConnection &connection_to = connectedLink(tracker, 1, 517);
+    connection_to.setRole(HCI_ROLE_SLAVE);
+
+    //notifications enabled but btstack never calls back, the queue must not keep growing
+    mock_defer_can_send = true;
+    reset_sent_for_test();
+    for (uint64_t i = 0; i < 500; i++) {
+        enqueueBurst(tracker, 1, std::string(100, 'x'), i);
+        tracker.sendPackets();
+    }
+    const auto &tx_queue = connection_to.getTxQueue();
+    REQUIRE(tx_queue.isCongested());
+    REQUIRE(tx_queue.size() <= tx_queue_max_frames);
+    REQUIRE(tx_queue.getQueuedBytes() <= tx_queue_max_bytes);
+    REQUIRE(mock_sent_data.empty());
+
+    //control frames still get in, evicting the bulk backlog if they must
+    tracker.announceToConnections();
+    tracker.sendPackets();
+    REQUIRE(1 == tx_queue.size(tx_class_control));
+    REQUIRE(tx_queue.getQueuedBytes() <= tx_queue_max_bytes);
+
+    const auto queued = tx_queue.size();
+    tracker.reportDisconnection(1);
+    REQUIRE(queued == tracker.getTxDrops()[tx_drop_disconnected]);
+    mock_defer_can_send = false;
+    while (pending_can_send_count() > 0) {
+        run_pending_can_send();
+    }
+    tracker.printStats();
+}
+
+TEST_CASE("TxQueueDropsLowestTtlThenOldest", "[tx4]") {
+    TxQueue tx_queue;
+    TxDropCounts drops{};
+    auto frame = [](const uint8_t tag) {
+        return std::make_shared<const std::vector<uint8_t>>(tx_queue_max_bytes / tx_queue_max_frames, tag);
+    };
+    //nothing is set aside until a frame is queued
+    REQUIRE(0 == tx_queue.getHeldBytes());
+    for (uint16_t i = 0; i < tx_queue_max_frames; i++) {
+        REQUIRE(tx_queue.push(frame(i == 10 ? 1 : 0), tx_class_normal, i == 10 ? 1 : 7, i, drops));
+    }
+    REQUIRE(tx_queue_max_frames == tx_queue.size());
+
+    //the low ttl frame goes first, then the oldest
+    REQUIRE(tx_queue.push(frame(2), tx_class_normal, 7, 100, drops));
+    REQUIRE(tx_queue_max_frames == tx_queue.size());
+    tx_queue.forEach(tx_class_normal, [](const TxEntry &entry) {
+        REQUIRE(1 != entry.frame->front());
+    });
+    REQUIRE(tx_queue.push(frame(2), tx_class_normal, 7, 101, drops));
+    REQUIRE(1 == tx_queue.front()->enqueued_us);
+
+    //a bulk frame is worth less than anything queued, so it is the one refused
+    REQUIRE(!tx_queue.push(frame(3), tx_class_bulk, 7, 102, drops));
+    REQUIRE(3 == drops[tx_drop_frame_budget]);
+
+    const auto oversize = std::make_shared<const std::vector<uint8_t>>(tx_queue_max_bytes + 1, 0);
+    REQUIRE(!tx_queue.push(oversize, tx_class_control, 7, 103, drops));
+    REQUIRE(1 == drops[tx_drop_oversize]);
+    REQUIRE(tx_queue.getQueuedBytes() <= tx_queue_max_bytes);
+
+    tx_queue.clear(drops);
+    REQUIRE(tx_queue_max_frames == drops[tx_drop_disconnected]);
+    REQUIRE(0 == tx_queue.getQueuedBytes());
+    REQUIRE(0 == tx_queue.getHeldBytes());
+}
+
+TEST_CASE("FragmentsSizedToEachLinkMtu", "[frag1]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    constexpr uint16_t link_mtus[] = {185, 185, 247};
+    std::vector<BleConnection *> links;
+    for (hci_con_handle_t handle = 1; handle <= 3; handle++) {
+        auto &connection = connectedLink(tracker, handle, link_mtus[handle - 1]);
+        connection.setRole(HCI_ROLE_SLAVE);
+        links.push_back(&connection);
+    }
+    PacketPassAlong pass_along(noiseEncrypted, 7, 0x198d35e50ee, packet_flag_has_recipient, 0x1a4d912f6a99af5e,
+                               0x6ff9f65a6858d8ff);
+    std::string payload(500, 'x');
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<char>(i);
+    }
+    pass_along.setPayload(payload);
+    const auto stored_handle = tracker.storePacketAndReturnIfNew(pass_along);
+    const auto stored = tracker.packetForHandle(stored_handle);
+    const auto frame = ProtocolWriter::encodedFrame(stored);
+    REQUIRE(frame->size() > links[0]->getMaxFrameSize());
+
+    //links with the same mtu queue the very same fragment frames
+    tracker.enqueueBroadcastPacket(stored_handle);
+    mock_defer_can_send = true;
+    reset_sent_for_test();
+    tracker.sendPackets();
+    auto queued = [](const BleConnection &link) {
+        std::vector<EncodedFrame> frames;
+        link.getTxQueue().forEach(tx_class_bulk, [&frames](const TxEntry &entry) {
+            frames.push_back(entry.frame);
+        });
+        return frames;
+    };
+    const auto first = queued(*links[0]);
+    const auto second = queued(*links[1]);
+    const auto third = queued(*links[2]);
+    REQUIRE(first.size() == second.size());
+    REQUIRE(first.size() > third.size());
+    REQUIRE(first == second);
+    REQUIRE(stored->getEncodedFragments(links[0]->getMaxFrameSize()) != nullptr);
+    REQUIRE(stored->getEncodedFragments(links[2]->getMaxFrameSize()) != nullptr);
+
+    //each fragment fits the link and the slices join back into the original frame
+    std::vector<uint8_t> joined;
+    for (size_t i = 0; i < first.size(); i++) {
+        const auto &fragment = *first[i];
+        REQUIRE(fragment.size() <= links[0]->getMaxFrameSize());
+        const uint8_t expected_type = i == 0 ? type_fragment_start : i == first.size() - 1 ? fragmentEnd
+                                                                                            : fragmentContinue;
+        REQUIRE(expected_type == fragment[1]);
+        BinaryReader reader(0, fragment.data(), fragment.size());
+        reader.read_data(12); //version, type, ttl, timestamp, flags
+        const auto payload_length = reader.read_uint16();
+        reader.read_data(16); //sender and recipient
+        reader.read_uint64(); //fragment id
+        REQUIRE(i == reader.read_uint16());
+        REQUIRE(first.size() == reader.read_uint16());
+        REQUIRE(noiseEncrypted == reader.read_uint8());
+        const auto slice_length = payload_length - 13;
+        const auto slice = reader.read_data(slice_length);
+        joined.insert(joined.end(), slice, slice + slice_length);
+    }
+    REQUIRE(*frame == joined);
+
+    while (pending_can_send_count() > 0) {
+        run_pending_can_send();
+    }
+    mock_defer_can_send = false;
+    REQUIRE(0 == tracker.getQueuedFrameBytes());
+}
+
+TEST_CASE("MtuTooSmallToFragmentIsDropped", "[frag2]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    auto &connection = connectedLink(tracker, 1);
+    connection.setRole(HCI_ROLE_SLAVE);
+    REQUIRE(att_default_mtu - 3 == connection.getMaxFrameSize());
+
+    const auto pass_along = passAlong(0, std::string(100, 'x'));
+    reset_sent_for_test();
+    REQUIRE(!tracker.SendPacketToConnection(pass_along, connection));
+    REQUIRE(1 == tracker.getTxDrops()[tx_drop_oversize]);
+    REQUIRE(connection.getTxQueue().empty());
+    REQUIRE(mock_sent_data.empty());
+}
+
+TEST_CASE("RefusedFragmentFailsTheSend", "[frag5]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    auto &connection = connectedLink(tracker, 1);
+    connection.setRole(HCI_ROLE_SLAVE);
+    connection.setMtu(185);
+    //a queue full of control frames has no room for bulk fragments
+    auto &tx_queue = connection.getTxQueue();
+    TxDropCounts drops{};
+    for (uint16_t i = 0; i < tx_queue_max_frames; i++) {
+        REQUIRE(tx_queue.push(std::make_shared<const std::vector<uint8_t>>(20, 0), tx_class_control, 7, i, drops));
+    }
+
+    const auto pass_along = passAlong(0, std::string(500, 'x'));
+    reset_sent_for_test();
+    mock_defer_can_send = true;
+    REQUIRE(!tracker.SendPacketToConnection(pass_along, connection));
+    REQUIRE(1 == tracker.getTxDrops()[tx_drop_frame_budget]);
+    REQUIRE(tx_queue_max_frames == tx_queue.size());
+    tx_queue.forEach(tx_class_bulk, [](const TxEntry &) {
+        FAIL("no fragment should be queued");
+    });
+    tx_queue.clear(drops);
+    mock_defer_can_send = false;
+}
+
+TEST_CASE("DroppedFragmentGroupDoesNotBlockLaterSends", "[frag7]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    auto &connection = connectedLink(tracker, 1, 185);
+    connection.setRole(HCI_ROLE_SLAVE);
+    auto &tx_queue = connection.getTxQueue();
+    TxDropCounts drops{};
+    auto fill_with_control = [&tx_queue, &drops]() {
+        for (uint16_t i = 0; i < tx_queue_max_frames; i++) {
+            REQUIRE(tx_queue.push(std::make_shared<const std::vector<uint8_t>>(20, 0), tx_class_control, 7, i, drops));
+        }
+    };
+    const auto first = passAlong(0, std::string(500, 'x'));
+    const auto second = passAlong(1, std::string(500, 'y'));
+    reset_sent_for_test();
+    mock_defer_can_send = true;
+
+    //the first group is refused, once the link drains it goes out whole when sent again
+    fill_with_control();
+    REQUIRE(!tracker.SendPacketToConnection(first, connection));
+    tx_queue.clear(drops);
+    REQUIRE(tracker.SendPacketToConnection(first, connection));
+    const auto fragments = tx_queue.size(tx_class_bulk);
+    REQUIRE(fragments > 1);
+
+    //the same again with the queue emptied by popping rather than cleared, then a second packet behind it
+    tx_queue.clear(drops);
+    fill_with_control();
+    REQUIRE(!tracker.SendPacketToConnection(first, connection));
+    while (!tx_queue.empty()) {
+        tx_queue.pop();
+    }
+    REQUIRE(tracker.SendPacketToConnection(second, connection));
+    REQUIRE(tracker.SendPacketToConnection(first, connection));
+    REQUIRE(2 * fragments == tx_queue.size(tx_class_bulk));
+    REQUIRE(0 == tracker.getTxDrops()[tx_drop_fragment_group]);
+    tx_queue.clear(drops);
+    run_pending_can_send(); //the tracker is going, nothing may be left to call back into it
+    mock_defer_can_send = false;
+}
+
+TEST_CASE("FragmentGroupRelayedOnlyWhenComplete", "[frag3]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    set_mock_time(1000 * 1000);
+    BleConnection &connection_from = connectedLink(tracker, 1, 185);
+    connectedLink(tracker, 2, 517);
+
+    auto fragments_of = [](const uint64_t timestamp) {
+        PacketPassAlong original(noiseEncrypted, 7, timestamp, 0, 0x1a4d912f6a99af5e, 0);
+        std::string payload(400, 'f');
+        original.setPayload(payload);
+        return ProtocolWriter::encodedFragments(&original, 182);
+    };
+    const auto fragments = fragments_of(0x198d35e50ee);
+    REQUIRE(fragments->size() > 2);
+
+    //delivered out of order, nothing goes on until the last one turns up
+    reset_sent_for_test();
+    for (size_t i = 1; i < fragments->size(); i++) {
+        const auto &frame = *(*fragments)[i];
+        processor.processWrite(connection_from, 0, frame.data(), frame.size());
+        tracker.sendPackets();
+    }
+    REQUIRE(mock_sent_data.empty());
+    REQUIRE(1 == tracker.getFragmentGroupsCount());
+    REQUIRE(tracker.getIncompleteFragmentBytes() > 0);
+
+    const auto &first = *(*fragments)[0];
+    processor.processWrite(connection_from, 0, first.data(), first.size());
+    mock_defer_can_send = true;
+    tracker.sendPackets();
+    while (pending_can_send_count() > 0) {
+        run_pending_can_send();
+    }
+    mock_defer_can_send = false;
+    REQUIRE(0 == tracker.getFragmentGroupsCount());
+    REQUIRE(0 == tracker.getIncompleteFragmentBytes());
+    //relayed back to back from the start, each one ttl lower
+    size_t offset = 0;
+    for (const auto &fragment: *fragments) {
+        REQUIRE(offset + fragment->size() <= mock_sent_data.size());
+        REQUIRE(type_fragment_start + (offset ? 1 : 0) <= mock_sent_data[offset + 1]);
+        REQUIRE(fragment->at(2) - 1 == mock_sent_data[offset + 2]);
+        offset += fragment->size();
+    }
+    REQUIRE(fragmentEnd == mock_sent_data[offset - fragments->back()->size() + 1]);
+    REQUIRE(offset == mock_sent_data.size());
+
+    //a group missing a fragment is dropped whole once it has waited too long, giving its bytes back
+    const auto &memory = tracker.getMemoryBudget();
+    const auto packet_bytes_before = memory.getUsed(memory_store_packets);
+    const auto stale = fragments_of(0x198d35e5100);
+    for (size_t i = 0; i + 1 < stale->size(); i++) {
+        const auto &frame = *(*stale)[i];
+        processor.processWrite(connection_from, 0, frame.data(), frame.size());
+    }
+    const auto packets_before = tracker.getAnyPacket();
+    REQUIRE(packets_before != nullptr);
+    REQUIRE(tracker.getIncompleteFragmentBytes() > 0);
+    tracker.expireFragmentGroups();
+    REQUIRE(1 == tracker.getFragmentGroupsCount());
+    set_mock_time(1000 * 1000 + thirty_seconds_in_us + 1);
+    tracker.expireFragmentGroups();
+    REQUIRE(0 == tracker.getFragmentGroupsCount());
+    REQUIRE(0 == tracker.getIncompleteFragmentBytes());
+    REQUIRE(packet_bytes_before == memory.getUsed(memory_store_packets));
+    reset_sent_for_test();
+    tracker.sendPackets();
+    REQUIRE(mock_sent_data.empty());
+    tracker.printStats();
+    set_mock_time(0);
+}
+
+TEST_CASE("FragmentGroupsFitTheStore", "[frag6]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    auto &connection = tracker.connectionForConnHandle(1);
+    auto store_fragment = [&](const uint64_t id, const uint16_t index, const uint16_t total, const uint64_t timestamp) {
+        std::string payload;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            payload.push_back(static_cast<char>(id >> shift));
+        }
+        for (const auto value: {index, total}) {
+            payload.push_back(static_cast<char>(value >> 8));
+            payload.push_back(static_cast<char>(value));
+        }
+        payload.push_back(static_cast<char>(noiseEncrypted));
+        payload.append(20, 'f');
+        PacketPassAlong pass_along(fragmentContinue, 7, timestamp, 0, 0x1a4d912f6a99af5e, 0);
+        pass_along.setPayload(payload);
+        const auto stored = tracker.storePacketAndReturnIfNew(pass_along);
+        if (stored) {
+            tracker.enqueueFragmentPacket(stored, &connection, 0x1a4d912f6a99af5e);
+        }
+        return stored;
+    };
+
+    //more fragments than the store holds could never all be there at once, the group is refused and counted once
+    REQUIRE_FALSE(store_fragment(1, 0, max_stored_packets + 1, 10));
+    REQUIRE_FALSE(store_fragment(1, 1, max_stored_packets + 1, 10));
+    REQUIRE(1 == tracker.getFragmentGroupsOversize());
+    REQUIRE(nullptr == tracker.getAnyPacket());
+
+    //a full store makes room with anything but a fragment waiting on its group, even when that is the oldest
+    REQUIRE(store_fragment(2, 0, 2, 1));
+    for (uint16_t i = 1; i < max_stored_packets; i++) {
+        PacketPassAlong pass_along(noiseEncrypted, 7, 100 + i, 0, 0x1a4d912f6a99af5e, 0);
+        std::string payload(20, 'p');
+        pass_along.setPayload(payload);
+        REQUIRE(tracker.storePacketAndReturnIfNew(pass_along));
+    }
+    REQUIRE(store_fragment(2, 1, 2, 2));
+    REQUIRE(0 == tracker.getFragmentGroupsIncomplete());
+    REQUIRE(0 == tracker.getFragmentGroupsCount());
+
+    //with nothing else to give up a pending fragment goes, and the group that lost it is counted when it completes
+    REQUIRE(store_fragment(3, 0, 2, 3));
+    for (uint16_t i = 0; i + 1 < max_stored_packets; i++) {
+        REQUIRE(store_fragment(4, i, max_stored_packets, 200 + i));
+    }
+    REQUIRE(store_fragment(3, 1, 2, 4));
+    REQUIRE(1 == tracker.getFragmentGroupsIncomplete());
+    REQUIRE(1 == tracker.getFragmentGroupsCount());
+    tracker.printStats();
+}
+
+TEST_CASE("TxQueueEvictsWholeFragmentGroup", "[frag4]") {
+    TxQueue tx_queue;
+    TxDropCounts drops{};
+    constexpr size_t frame_bytes = tx_queue_max_bytes / tx_queue_max_frames;
+    auto frame = [&] {
+        return std::make_shared<const std::vector<uint8_t>>(frame_bytes, 0);
+    };
+    //an in progress group, one fragment already handed to btstack
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(tx_queue.push(frame(), tx_class_bulk, 7, i, drops, 1));
+    }
+    tx_queue.pop();
+    //another group queued behind it
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(tx_queue.push(frame(), tx_class_bulk, 7, 10 + i, drops, 2));
+    }
+    while (tx_queue.size() < tx_queue_max_frames) {
+        REQUIRE(tx_queue.push(frame(), tx_class_bulk, 7, 20, drops));
+    }
+
+    //the oldest frames are group 1, but it is part way out so group 2 goes instead, all of it
+    REQUIRE(tx_queue.push(frame(), tx_class_bulk, 7, 30, drops));
+    REQUIRE(4 == drops[tx_drop_frame_budget]);
+    tx_queue.forEach(tx_class_bulk, [](const TxEntry &entry) {
+        REQUIRE(2 != entry.group);
+    });
+    REQUIRE(1 == tx_queue.front()->group);
+    //stragglers of the dropped group are refused rather than sent without the rest
+    REQUIRE(!tx_queue.push(frame(), tx_class_bulk, 7, 31, drops, 2));
+    REQUIRE(1 == drops[tx_drop_fragment_group]);
+    REQUIRE(tx_queue.size() * frame_bytes == tx_queue.getQueuedBytes());
+}
+
+TEST_CASE("RelayedFramesPassThroughWithTtlPatched", "[raw1]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection_from = connectedLink(tracker, 1, 517);
+    connectedLink(tracker, 2, 517);
+
+    //an opaque payload flagged as compressed, relayed as it arrived rather than inflated and rebuilt
+    std::vector<uint8_t> received;
+    const BinaryWriter writer(received);
+    writer.write_uint8(1);
+    writer.write_uint8(noiseEncrypted);
+    writer.write_uint8(5);
+    writer.write_uint64(0x198d35e50ee);
+    writer.write_uint8(packet_flag_has_recipient | packet_flag_is_compressed | packet_flag_has_signature);
+    writer.write_uint16(2 + 40);
+    writer.write_uint64(0x1a4d912f6a99af5e);
+    writer.write_uint64(0x6ff9f65a6858d8ff);
+    writer.write_uint16(300); //original size
+    for (uint8_t i = 0; i < 40; i++) {
+        writer.write_uint8(0x78 + i);
+    }
+    for (uint8_t i = 0; i < 64; i++) {
+        writer.write_uint8(i);
+    }
+    writer.write_uint8(0);
+
+    processor.processWrite(connection_from, 0, received.data(), received.size());
+    reset_sent_for_test();
+    tracker.sendPackets();
+    REQUIRE(received.size() == mock_sent_data.size());
+    REQUIRE(4 == mock_sent_data[2]);
+    mock_sent_data[2] = received[2];
+    REQUIRE(received == mock_sent_data);
+}
+
+TEST_CASE("AdmissionRejectsOnHeaderAlone", "[admit1]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    //an announce sets the clock, after which timestamps are checked
+    const uint8_t data_len = data2.length() / 2;
+    uint8_t announce[data_len];
+    populate_array_from_string(announce, data2);
+    processor.processWrite(connection, 0, announce, sizeof(announce));
+    const auto now = tracker.getTimeMs();
+
+    auto write_frame = [&](const uint8_t type, const uint8_t ttl, const uint64_t timestamp, const uint8_t index) {
+        std::vector<uint8_t> payload;
+        const BinaryWriter writer(payload);
+        writer.write_uint64(0x0102030405060708); //fragment id
+        writer.write_uint16(index);
+        writer.write_uint16(2);
+        writer.write_uint8(noiseEncrypted);
+        for (uint8_t i = 0; i < 20; i++) {
+            writer.write_uint8(i);
+        }
+        const auto frame = airFrame(type, ttl, timestamp, 0x1a4d912f6a99af5e, payload);
+        processor.processWrite(connection, 0, frame.data(), frame.size());
+    };
+    const auto &rejects = tracker.getAdmissionRejects();
+
+    write_frame(noiseEncrypted, 3, now, 0);
+    write_frame(noiseEncrypted, 2, now, 0);
+    REQUIRE(1 == rejects[admission_reject_duplicate]);
+    write_frame(noiseEncrypted, 0, now + 1, 0);
+    REQUIRE(1 == rejects[admission_reject_ttl]);
+    write_frame(noiseEncrypted, 3, now - 6 * 60 * 1000, 0);
+    REQUIRE(1 == rejects[admission_reject_too_old]);
+    write_frame(noiseEncrypted, 3, now + 6 * 60 * 1000, 0);
+    REQUIRE(1 == rejects[admission_reject_future]);
+    //fragments of one packet share a header, their index in the payload keeps them apart
+    write_frame(fragmentContinue, 3, now, 0);
+    write_frame(fragmentContinue, 3, now, 1);
+    REQUIRE(1 == rejects[admission_reject_duplicate]);
+    REQUIRE(0 == tracker.getFragmentGroupsCount());
+
+    //only the announce and the first copy of the packet got as far as being stored
+    REQUIRE(tracker.getAnyPacket() != nullptr);
+    tracker.printStats();
+}
+
+TEST_CASE("CorruptCopyDoesNotBlockAGoodOne", "[admit2]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    ProtocolWriter::setCompression(16, 182);
+    Message message(7, 1000, 0, 0x1a4d912f6a99af5e, 0);
+    message.setMessageId("6F6A6C8A-3C7D-4E45-9E5C-2C0A3F1D9B11");
+    message.setSenderNickname("adam");
+    std::string content;
+    for (int i = 0; i < 20; i++) {
+        content += "the quick brown fox jumps over the lazy dog ";
+    }
+    message.setContent(content);
+    const auto frame = ProtocolWriter::encodedFrame(&message);
+    ProtocolWriter::setCompression(0, 0);
+    PacketView packet;
+    REQUIRE(PacketView::parse(frame->data(), 0, frame->size(), packet));
+    REQUIRE(packet.flags & packet_flag_is_compressed);
+
+    //the same header and first payload bytes, so the same admission key, but the tail won't decompress
+    auto corrupt = *frame;
+    corrupt[&packet.payload.back() - frame->data()] ^= 0xff;
+    processor.processWrite(connection, 0, corrupt.data(), corrupt.size());
+    REQUIRE_FALSE(tracker.hasMessageWithId("6F6A6C8A-3C7D-4E45-9E5C-2C0A3F1D9B11"));
+    REQUIRE(0 == tracker.getSeenFilter().getKeys());
+
+    processor.processWrite(connection, 0, frame->data(), frame->size());
+    REQUIRE(tracker.hasMessageWithId("6F6A6C8A-3C7D-4E45-9E5C-2C0A3F1D9B11"));
+    REQUIRE(0 == tracker.getAdmissionRejects()[admission_reject_duplicate]);
+    REQUIRE(0 == tracker.getAdmissionRejects()[admission_reject_seen]);
+
+    //once accepted, later copies are turned away as before
+    processor.processWrite(connection, 0, frame->data(), frame->size());
+    REQUIRE(1 == tracker.getAdmissionRejects()[admission_reject_duplicate]);
+}
+
+TEST_CASE("PacketViewParseBenchmark", "[view1]") {
+    constexpr int rounds = 1000;
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    std::vector<std::vector<uint8_t>> frames;
+    for (const auto &data: {data2, data4, data5, data6, noise_encrypted2}) {
+        std::vector<uint8_t> frame(data.length() / 2);
+        populate_array_from_string(frame.data(), data);
+        frames.push_back(std::move(frame));
+    }
+
+    size_t parsed = 0;
+    auto allocations_before = allocation_count;
+    const auto view_start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (const auto &frame: frames) {
+            PacketView packet;
+            MessageView message;
+            parsed += PacketView::parse(frame.data(), 0, frame.size(), packet) &&
+                    (packet.type != type_message || MessageView::parse(packet.payload, message));
+        }
+    }
+    const auto view_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - view_start).count();
+    const auto view_allocations = allocation_count - allocations_before;
+
+    //what every frame cost before, owned strings for the payload, signature and message fields
+    allocations_before = allocation_count;
+    const auto owned_start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (const auto &frame: frames) {
+            PacketView packet;
+            PacketView::parse(frame.data(), 0, frame.size(), packet);
+            if (MessageView view; packet.type == type_message && MessageView::parse(packet.payload, view)) {
+                Message message(packet.ttl, packet.timestamp_ms, packet.flags, packet.sender, packet.recipient,
+                                packet.signature);
+                processor.processMessage(message, view);
+            } else {
+                std::string payload(packet.payload.begin(), packet.payload.end());
+                PacketPassAlong pass_along(packet.type, packet.ttl, packet.timestamp_ms, packet.flags, packet.sender,
+                                           packet.recipient);
+                pass_along.setPayload(payload);
+            }
+        }
+    }
+    const auto owned_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - owned_start).count();
+    const auto owned_allocations = allocation_count - allocations_before;
+
+    const auto per_packet = static_cast<int64_t>(rounds * frames.size());
+    LOG_DEBUG("parse over %" PRId64 " frames - view: %" PRId64 "ns/packet, %zu allocations, owned: %" PRId64
+              "ns/packet, %zu allocations\n", per_packet, static_cast<int64_t>(view_ns) / per_packet,
+              view_allocations, static_cast<int64_t>(owned_ns) / per_packet, owned_allocations);
+    REQUIRE(rounds * frames.size() == parsed);
+    REQUIRE(0 == view_allocations);
+    REQUIRE(owned_allocations >= rounds * frames.size());
+
+    //a duplicate is recognised from the view, nothing is copied out of the frame
+    const auto &relayed = frames.back();
+    processor.processWrite(connection, 0, relayed.data(), relayed.size());
+    allocations_before = allocation_count;
+    processor.processWrite(connection, 0, relayed.data(), relayed.size());
+    REQUIRE(allocation_count == allocations_before);
+}
+
+TEST_CASE("DecompressReusesDecompressorAndBuffer", "[inflate1]") {
+    constexpr int frame_count = 10000;
+    BleConnectionTracker tracker;
+    const ProtocolProcessor processor(tracker);
+
+    //payloads of varying size so the old per frame allocations don't just reuse one freed block
+    std::vector<std::vector<uint8_t>> compressed;
+    std::vector<uint16_t> original_sizes;
+    const auto compressor = libdeflate_alloc_compressor(6);
+    for (uint16_t size = 64; size <= 1024; size += 64) {
+        std::vector<uint8_t> original(size);
+        for (uint16_t i = 0; i < size; i++) {
+            original[i] = static_cast<uint8_t>('a' + i % (size / 64 + 3));
+        }
+        std::vector<uint8_t> out(libdeflate_zlib_compress_bound(compressor, size));
+        out.resize(libdeflate_zlib_compress(compressor, original.data(), size, out.data(), out.size()));
+        compressed.push_back(std::move(out));
+        original_sizes.push_back(size);
+    }
+    libdeflate_free_compressor(compressor);
+
+    const auto heap_before = mallinfo2();
+    auto allocations_before = allocation_count;
+    size_t per_frame_bytes = 0;
+    const auto per_frame_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frame_count; i++) {
+        const auto &frame = compressed[i % compressed.size()];
+        //the decompressor and buffer that used to be created for every compressed frame
+        std::vector<uint8_t> decompressed(original_sizes[i % compressed.size()]);
+        size_t decompressed_size = 0;
+        const auto d = libdeflate_alloc_decompressor();
+        libdeflate_zlib_decompress(d, frame.data(), frame.size(), decompressed.data(), decompressed.size(),
+                                   &decompressed_size);
+        libdeflate_free_decompressor(d);
+        per_frame_bytes += decompressed_size;
+    }
+    const auto per_frame_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - per_frame_start).count();
+    const auto per_frame_allocations = allocation_count - allocations_before;
+    const auto heap_between = mallinfo2();
+
+    allocations_before = allocation_count;
+    size_t reused_bytes = 0;
+    const auto reused_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frame_count; i++) {
+        reused_bytes += processor.decompress(compressed[i % compressed.size()],
+                                            original_sizes[i % compressed.size()]).size();
+    }
+    const auto reused_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - reused_start).count();
+    const auto reused_allocations = allocation_count - allocations_before;
+    const auto heap_after = mallinfo2();
+
+    LOG_DEBUG("decompress %d frames - per frame: %" PRId64 "ns/frame, %zu allocations, heap free %zu -> %zu, "
+              "reused: %" PRId64 "ns/frame, %zu allocations, heap free %zu -> %zu\n", frame_count,
+              static_cast<int64_t>(per_frame_ns) / frame_count, per_frame_allocations, heap_before.fordblks,
+              heap_between.fordblks, static_cast<int64_t>(reused_ns) / frame_count, reused_allocations,
+              heap_between.fordblks, heap_after.fordblks);
+    REQUIRE(per_frame_bytes == reused_bytes);
+    REQUIRE(0 == reused_allocations);
+    REQUIRE(heap_between.arena == heap_after.arena);
+
+    //a claimed size past the limit is refused before anything is written
+    allocations_before = allocation_count;
+    REQUIRE(processor.decompress(compressed.front(), max_decompressed_size + 1).empty());
+    REQUIRE(processor.decompress(compressed.front(), original_sizes.front() + 1).empty());
+    REQUIRE(allocation_count == allocations_before);
+}
+
+TEST_CASE("LargePayloadsCompressedOnceWhenWorthIt", "[deflate1]") {
+    BleConnectionTracker tracker;
+    const ProtocolProcessor processor(tracker);
+    ProtocolWriter::setCompression(16, 182);
+
+    Message message(7, 0x198d35e50ee, 0, 0x1a4d912f6a99af5e, 0);
+    message.setMessageId("6F6A6C8A-3C7D-4E45-9E5C-2C0A3F1D9B11");
+    message.setSenderNickname("adam");
+    std::string content;
+    for (int i = 0; i < 20; i++) {
+        content += "the quick brown fox jumps over the lazy dog ";
+    }
+    message.setContent(content);
+    const auto frame = ProtocolWriter::encodedFrame(&message);
+    REQUIRE(frame == ProtocolWriter::encodedFrame(&message)); //compressed the once and cached on the packet
+
+    PacketView packet;
+    REQUIRE(PacketView::parse(frame->data(), 0, frame->size(), packet));
+    REQUIRE(packet.flags & packet_flag_is_compressed);
+    REQUIRE(frame->size() < content.size());
+    const auto payload = processor.decompress(packet.payload, packet.original_size);
+    MessageView view;
+    REQUIRE(MessageView::parse(payload, view));
+    REQUIRE(content == view.content);
+
+    //too little to gain from a short one
+    Message short_message(7, 0x198d35e50ef, 0, 0x1a4d912f6a99af5e, 0);
+    short_message.setMessageId("1");
+    short_message.setSenderNickname("adam");
+    short_message.setContent("hi hi hi hi");
+    const auto short_frame = ProtocolWriter::encodedFrame(&short_message);
+    REQUIRE(PacketView::parse(short_frame->data(), 0, short_frame->size(), packet));
+    REQUIRE_FALSE(packet.flags & packet_flag_is_compressed);
+
+    ProtocolWriter::setCompression(0, 0);
+}
+
+TEST_CASE("InboundFramesDeferredAndDrainedInBatches", "[inbound1]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    auto &inbound_ring = tracker.getInboundRing();
+
+    const uint8_t data_len = data2.length() / 2;
+    uint8_t announce[data_len];
+    populate_array_from_string(announce, data2);
+    const uint8_t noise_len = noise_encrypted2.length() / 2;
+    uint8_t noise[noise_len];
+    populate_array_from_string(noise, noise_encrypted2);
+
+    //queued from the callbacks, nothing is processed until the main loop drains them
+    REQUIRE(inbound_ring.push(1, announce, sizeof(announce)));
+    REQUIRE(inbound_ring.push(2, noise, sizeof(noise)));
+    REQUIRE(2 == inbound_ring.getDepth());
+    REQUIRE(nullptr == tracker.peerWithId(0x19077f0222faf5ce));
+
+    //a budget smaller than one frame still takes one each time
+    REQUIRE(1 == processor.processInbound(1));
+    REQUIRE("adam" == tracker.peerWithId(0x19077f0222faf5ce)->getName());
+    REQUIRE(1 == inbound_ring.getDepth());
+    REQUIRE(1 == processor.processInbound(inbound_drain_budget_bytes));
+    REQUIRE(inbound_ring.empty());
+    REQUIRE(0 == processor.processInbound(inbound_drain_budget_bytes));
+
+    //frames of every size keep their order and bytes as the ring wraps, and a full ring drops rather than blocks
+    std::vector<uint8_t> frame(inbound_max_frame_size);
+    uint32_t next_push = 0;
+    uint32_t next_pop = 0;
+    for (int round = 0; round < 200; round++) {
+        while (true) {
+            const auto size = static_cast<uint16_t>(1 + next_push * 37 % inbound_max_frame_size);
+            std::fill_n(frame.begin(), size, static_cast<uint8_t>(next_push));
+            if (!inbound_ring.push(static_cast<hci_con_handle_t>(next_push & 0xfff), frame.data(), size)) {
+                break;
+            }
+            next_push++;
+        }
+        for (int popped = 0; popped < 1 + round % 5 && !inbound_ring.empty(); popped++, next_pop++) {
+            InboundFrame inbound;
+            REQUIRE(inbound_ring.front(inbound));
+            REQUIRE((next_pop & 0xfff) == inbound.con_handle);
+            REQUIRE(1 + next_pop * 37 % inbound_max_frame_size == inbound.size);
+            REQUIRE(static_cast<uint8_t>(next_pop) == inbound.data[0]);
+            REQUIRE(static_cast<uint8_t>(next_pop) == inbound.data[inbound.size - 1]);
+            inbound_ring.pop();
+        }
+    }
+    REQUIRE(200 == inbound_ring.getOverflowDrops());
+    REQUIRE(next_push - next_pop == inbound_ring.getDepth());
+    REQUIRE(inbound_ring.getHighWater() >= inbound_ring.getDepth());
+    REQUIRE_FALSE(inbound_ring.push(1, frame.data(), inbound_max_frame_size + 1));
+}
+
+TEST_CASE("InboundFramesOfADisconnectionAreDropped", "[inbound2]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    auto &inbound_ring = tracker.getInboundRing();
+    const uint8_t data_len = data2.length() / 2;
+    uint8_t announce[data_len];
+    populate_array_from_string(announce, data2);
+    const uint8_t noise_len = noise_encrypted2.length() / 2;
+    uint8_t noise[noise_len];
+    populate_array_from_string(noise, noise_encrypted2);
+
+    //the announce was queued before its link went, the handle may be reused before the main loop gets to it
+    REQUIRE(inbound_ring.push(1, announce, sizeof(announce)));
+    REQUIRE(inbound_ring.push(2, noise, sizeof(noise)));
+    tracker.reportDisconnection(1);
+    REQUIRE(1 == inbound_ring.getDiscarded());
+    REQUIRE(2 == processor.processInbound(inbound_drain_budget_bytes));
+    REQUIRE(inbound_ring.empty());
+    REQUIRE(nullptr == tracker.peerWithId(0x19077f0222faf5ce));
+    REQUIRE(tracker.getAnyPacket() != nullptr);
+}
+
+TEST_CASE("LongWritesPutBackTogetherOnExecute", "[longwrite1]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    constexpr hci_con_handle_t handle = 1;
+
+    //larger than any single write, as a client with a small mtu would send it
+    std::vector<uint8_t> payload(700);
+    for (uint16_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    const auto frame = airFrame(noiseEncrypted, 5, 0x198d35e50ee, 0x1a4d912f6a99af5e, payload);
+
+    constexpr uint16_t part_size = 18; //a 23 byte mtu less the prepare write header
+    for (uint16_t offset = 0; offset < frame.size(); offset += part_size) {
+        const auto size = static_cast<uint16_t>(std::min<size_t>(part_size, frame.size() - offset));
+        REQUIRE(0 == tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_ACTIVE, offset, &frame[offset], size));
+    }
+    REQUIRE(tracker.getInboundRing().empty()); //nothing goes anywhere until it is executed
+    REQUIRE(0 == tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_VALIDATE, 0, nullptr, 0));
+    REQUIRE(0 == tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_EXECUTE, 0, nullptr, 0));
+    REQUIRE(tracker.connectionForConnHandle(handle).getPreparedWrite().empty());
+    REQUIRE(1 == processor.processInbound(inbound_drain_budget_bytes));
+    const auto stored = tracker.getAnyPacket();
+    REQUIRE(stored != nullptr);
+    REQUIRE(noiseEncrypted == stored->getPacketType());
+    REQUIRE(700 == static_cast<const PacketPassAlong *>(stored)->getPayload().size());
+
+    //a gap, or more than the limit, is refused and a cancel throws away what was collected
+    const std::vector<uint8_t> oversize(max_prepared_write_size);
+    REQUIRE(0 == tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_ACTIVE, 0, frame.data(), part_size));
+    REQUIRE(ATT_ERROR_INVALID_OFFSET ==
+            tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_ACTIVE, 2 * part_size, frame.data(), part_size));
+    REQUIRE(ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH ==
+            tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_ACTIVE, part_size, oversize.data(), oversize.size()));
+    REQUIRE(0 == tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_CANCEL, 0, nullptr, 0));
+    REQUIRE(tracker.connectionForConnHandle(handle).getPreparedWrite().empty());
+    REQUIRE(0 == tracker.receiveWrite(handle, ATT_TRANSACTION_MODE_EXECUTE, 0, nullptr, 0));
+    REQUIRE(tracker.getInboundRing().empty());
+}
+
+TEST_CASE("MessageCodecRoundTripsCapturedFrames", "[codec1]") {
+    constexpr int rounds = 10000;
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+
+    for (const auto &data: {data5, data6}) {
+        std::vector<uint8_t> frame(data.length() / 2);
+        populate_array_from_string(frame.data(), data);
+        PacketView packet;
+        REQUIRE(PacketView::parse(frame.data(), 0, frame.size(), packet));
+        REQUIRE(type_message == packet.type);
+
+        MessageView view;
+        REQUIRE(MessageCodec::decode(packet.payload, view));
+        Message message(packet.ttl, packet.timestamp_ms, packet.flags, packet.sender, packet.recipient);
+        REQUIRE(processor.processMessage(message, view));
+
+        //the payload written back out is byte for byte the one that arrived
+        std::vector<uint8_t> encoded(MessageCodec::encodedSize(message));
+        REQUIRE(encoded.data() + encoded.size() == MessageCodec::encode(message, encoded.data()));
+        REQUIRE(std::ranges::equal(packet.payload, encoded));
+
+        //and as a whole frame, less the ttl the relay takes off
+        const auto relayed = ProtocolWriter::encodedFrame(&message);
+        PacketView relayed_packet;
+        REQUIRE(PacketView::parse(relayed->data(), 0, relayed->size(), relayed_packet));
+        REQUIRE(packet.ttl - 1 == relayed_packet.ttl);
+        REQUIRE(std::ranges::equal(packet.payload, relayed_packet.payload));
+
+        size_t decoded = 0;
+        const auto decode_start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            decoded += MessageCodec::decode(packet.payload, view);
+        }
+        const auto decode_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - decode_start).count();
+        size_t encoded_bytes = 0;
+        const auto encode_start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            encoded_bytes += MessageCodec::encode(message, encoded.data()) - encoded.data();
+        }
+        const auto encode_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - encode_start).count();
+        LOG_DEBUG("message codec %zu byte payload - decode: %" PRId64 "ns, encode: %" PRId64 "ns\n",
+                  encoded.size(), static_cast<int64_t>(decode_ns) / rounds, static_cast<int64_t>(encode_ns) / rounds);
+        REQUIRE(rounds == decoded);
+        REQUIRE(rounds * encoded.size() == encoded_bytes);
+    }
+
+    //a payload cut short anywhere fails to decode rather than reading past the end
+    std::vector<uint8_t> frame(data6.length() / 2);
+    populate_array_from_string(frame.data(), data6);
+    PacketView packet;
+    REQUIRE(PacketView::parse(frame.data(), 0, frame.size(), packet));
+    for (size_t size = 0; size < packet.payload.size(); size++) {
+        MessageView view;
+        REQUIRE_FALSE(MessageCodec::decode(packet.payload.first(size), view));
+    }
+}
+
+TEST_CASE("HostileMessagesRejectedWithinBudget", "[budget1]") {
+    constexpr int rounds = 1000;
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    const auto compressor = libdeflate_alloc_compressor(6);
+
+    //as large as a compressed frame is allowed to inflate to, with the fields laid out to cost the most
+    auto hostile_payload = [](const uint8_t flags, const uint16_t content_size, const uint8_t mention_count,
+                              const uint8_t mention_size) {
+        std::vector<uint8_t> payload;
+        const BinaryWriter writer(payload);
+        writer.write_uint8(flags);
+        writer.write_uint64(0x198d35e50ee);
+        for (const auto field: {"6F6A6C8A-3C7D-4E45", "mallory"}) {
+            writer.write_uint8(strlen(field));
+            writer.write_data(reinterpret_cast<const uint8_t *>(field), strlen(field));
+        }
+        writer.write_uint16(content_size);
+        payload.resize(payload.size() + content_size, 'x');
+        for (const auto field: {"original", "recipient", "0123456789abcdef"}) {
+            writer.write_uint8(strlen(field));
+            writer.write_data(reinterpret_cast<const uint8_t *>(field), strlen(field));
+        }
+        writer.write_uint8(mention_count);
+        for (int i = 0; i < mention_count; i++) {
+            writer.write_uint8(mention_size);
+            payload.resize(payload.size() + mention_size, 'm');
+        }
+        return payload;
+    };
+    auto write_frame = [&](const std::vector<uint8_t> &payload, const uint64_t timestamp) {
+        std::vector<uint8_t> compressed(libdeflate_zlib_compress_bound(compressor, payload.size()));
+        compressed.resize(libdeflate_zlib_compress(compressor, payload.data(), payload.size(), compressed.data(),
+                                                   compressed.size()));
+        std::vector<uint8_t> body;
+        const BinaryWriter writer(body);
+        writer.write_uint16(payload.size()); //original size
+        writer.write_data(compressed.data(), compressed.size());
+        return airFrame(type_message, 3, timestamp, 0x1a4d912f6a99af5e, body, packet_flag_is_compressed);
+    };
+    constexpr uint8_t all_fields = message_flag_has_original_sender | message_flag_has_recipient_nickname |
+                                   message_flag_has_sender_peer_id | message_flag_has_mentions;
+    const std::vector<std::pair<MessageReject, std::vector<uint8_t>>> hostile = {
+        {message_reject_mentions, hostile_payload(all_fields, 0, 255, 14)},
+        {message_reject_bytes, hostile_payload(all_fields, 4000, 0, 0)},
+        {message_reject_allocations, hostile_payload(all_fields, 10, message_max_mentions, 1)},
+    };
+    const auto benign = hostile_payload(all_fields, 40, 2, 4);
+
+    for (const auto &[reason, payload]: hostile) {
+        REQUIRE(payload.size() <= max_decompressed_size);
+        std::vector<std::vector<uint8_t>> frames;
+        for (int round = 0; round < rounds; round++) {
+            frames.push_back(write_frame(payload, 0x198d35e50ee + round));
+        }
+        const auto allocations_before = allocation_count;
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto &frame: frames) {
+            processor.processWrite(connection, 0, frame.data(), frame.size());
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        const auto allocations = allocation_count - allocations_before;
+        LOG_DEBUG("hostile message (%d) of %zu bytes - %" PRId64 "ns/frame, %.1f allocations/frame\n", reason,
+                  payload.size(), static_cast<int64_t>(ns) / rounds, static_cast<float>(allocations) / rounds);
+        REQUIRE(rounds == tracker.getMessageRejects()[reason]);
+        //the admission record is all that is kept of it
+        REQUIRE(allocations <= rounds);
+    }
+    REQUIRE(nullptr == tracker.messageWithId("6F6A6C8A-3C7D-4E45"));
+
+    const auto frame = write_frame(benign, 0x198d35e50ee + rounds);
+    processor.processWrite(connection, 0, frame.data(), frame.size());
+    const auto message = tracker.messageWithId("6F6A6C8A-3C7D-4E45");
+    REQUIRE(message != nullptr);
+    REQUIRE(2 == message->getMentionCount());
+    libdeflate_free_compressor(compressor);
+}
+
+TEST_CASE("TrackerTurnsAwayEchoesOfDroppedPackets", "[seen2]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    set_mock_time(0);
+    constexpr uint8_t payload[] = {0xde, 0xad, 0xbe, 0xef};
+    //clock not set yet, so judged against uptime
+    const auto frame = airFrame(noiseEncrypted, 3, 1000, 0x1a4d912f6a99af5e, payload);
+    processor.processWrite(connection, 0, frame.data(), frame.size());
+    REQUIRE(tracker.getAnyPacket() != nullptr);
+    set_mock_time(1000ull * 1000 * 60 * 30);
+    tracker.cleanupStaleItems();
+    REQUIRE(tracker.getAnyPacket() == nullptr);
+    processor.processWrite(connection, 0, frame.data(), frame.size());
+    REQUIRE(1 == tracker.getAdmissionRejects()[admission_reject_seen]);
+    REQUIRE(tracker.getAnyPacket() == nullptr);
+    tracker.printStats();
+    set_mock_time(0);
+}
+
+TEST_CASE("QueuedPacketEvictedBeforeSendIsSkipped", "[pool2]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    connectedLink(tracker, 1, 517);
+    std::vector<PacketPassAlong> incoming;
+    for (uint64_t i = 0; i <= max_stored_packets; i++) {
+        incoming.push_back(passAlong(i, "pool payload"));
+    }
+    const auto queued = tracker.storePacketAndReturnIfNew(incoming.front());
+    tracker.enqueueBroadcastPacket(queued);
+    const auto allocations_before = allocation_count;
+    for (size_t i = 1; i < incoming.size(); i++) {
+        REQUIRE(tracker.storePacketAndReturnIfNew(incoming[i]));
+    }
+    REQUIRE(allocation_count == allocations_before);
+    REQUIRE(nullptr == tracker.packetForHandle(queued));
+    reset_sent_for_test();
+    tracker.sendPackets();
+    REQUIRE(mock_sent_data.empty());
+    REQUIRE(1 == tracker.getStaleHandles());
+    REQUIRE(tracker.packetForHandle(announce_handle) != nullptr);
+    tracker.printStats();
+}
+
+TEST_CASE("StoredMessagesKeptCompact", "[compact1]") {
+    //the layout this replaced, eight strings, a list of them, a peer pointer and the signature as a string
+    struct LegacyMessage : PacketBase {
+        LegacyMessage() : PacketBase(type_message) {
+        }
+
+        std::string packet_signature{};
+        uint8_t message_flags = 0;
+        uint64_t message_timestamp = 0;
+        std::string message_id{};
+        std::string sender_nickname{};
+        std::string original_sender_nickname{};
+        std::string content{};
+        std::string encrypted_content{};
+        std::string recipient_nickname{};
+        Peer *sender_peer = nullptr;
+        std::vector<std::string> mentions;
+        std::string channel{};
+    };
+
+    BleConnectionTracker tracker;
+    const ProtocolProcessor processor(tracker);
+    std::vector<std::vector<uint8_t>> payloads;
+    std::vector<std::vector<uint8_t>> signatures;
+    for (const auto &data: {data5, data6}) {
+        std::vector<uint8_t> frame(data.length() / 2);
+        populate_array_from_string(frame.data(), data);
+        PacketView packet;
+        REQUIRE(PacketView::parse(frame.data(), 0, frame.size(), packet));
+        payloads.emplace_back(packet.payload.begin(), packet.payload.end());
+        signatures.emplace_back(packet.signature.begin(), packet.signature.end());
+    }
+    //a busy channel message, mentions and all
+    Message busy(7, 0x198d35e50ee, packet_flag_has_signature, 0x1a4d912f6a99af5e, 0, signatures.front());
+    busy.setMessageFlags(message_flag_has_mentions | message_flag_has_channel | message_flag_has_sender_peer_id);
+    busy.setMessageId("6F6A6C8A-3C7D-4E45-9E5C-2C0A3F1D9B11");
+    busy.setSenderNickname("adam");
+    busy.setContent("@bob @carol meet at the north gate");
+    busy.setSenderPeerId(0xc67ff7caf2952326);
+    busy.addMention("bob");
+    busy.addMention("carol");
+    busy.setChannel("#mesh");
+    payloads.emplace_back(MessageCodec::encodedSize(busy));
+    MessageCodec::encode(busy, payloads.back().data());
+    signatures.push_back(signatures.front());
+
+    for (size_t i = 0; i < payloads.size(); i++) {
+        MessageView view;
+        REQUIRE(MessageCodec::decode(payloads[i], view));
+
+        auto bytes_before = allocation_bytes;
+        LegacyMessage legacy;
+        legacy.packet_signature.assign(signatures[i].begin(), signatures[i].end());
+        legacy.message_flags = view.flags;
+        legacy.message_timestamp = view.timestamp;
+        legacy.message_id = view.message_id;
+        legacy.sender_nickname = view.sender_nickname;
+        legacy.original_sender_nickname = view.original_sender_nickname;
+        legacy.content = view.content;
+        legacy.recipient_nickname = view.recipient_nickname;
+        view.forEachMention([&legacy](const std::string_view mention) {
+            legacy.mentions.emplace_back(mention);
+        });
+        legacy.mentions.shrink_to_fit();
+        legacy.channel = view.channel;
+        const auto legacy_bytes = sizeof(legacy) + allocation_bytes - bytes_before;
+
+        bytes_before = allocation_bytes;
+        Message message(7, 0x198d35e50ee, packet_flag_has_signature, 0x1a4d912f6a99af5e, 0, signatures[i]);
+        REQUIRE(processor.processMessage(message, view));
+        const auto compact_bytes = sizeof(message) + message.getTextBytes();
+        REQUIRE(compact_bytes <= sizeof(message) + allocation_bytes - bytes_before);
+
+        //the same payload and signature come back out
+        std::vector<uint8_t> encoded(MessageCodec::encodedSize(message));
+        MessageCodec::encode(message, encoded.data());
+        REQUIRE(payloads[i] == encoded);
+        REQUIRE(std::ranges::equal(signatures[i], message.getPacketSignature()));
+        LOG_DEBUG("stored message of %zu byte payload - before: %zu bytes, compact: %zu bytes (%zu inline)\n",
+                  payloads[i].size(), legacy_bytes, compact_bytes, sizeof(message));
+        REQUIRE(compact_bytes < legacy_bytes);
+
+        //the sender is known by now, the text block is the one allocation left
+        const auto allocations_before = allocation_count;
+        Message again(7, 0x198d35e50ee, packet_flag_has_signature, 0x1a4d912f6a99af5e, 0, signatures[i]);
+        REQUIRE(processor.processMessage(again, view));
+        REQUIRE(1 == allocation_count - allocations_before);
+    }
+    Message message;
+    message.addMention("dave");
+    message.addMention(std::string(300, 'x'));
+    std::vector<size_t> sizes;
+    message.forEachMention([&sizes](const std::string_view mention) {
+        sizes.push_back(mention.size());
+    });
+    REQUIRE(std::vector<size_t>{4, 255} == sizes);
+}
+
+TEST_CASE("TrackerKeepsPacketsTenMinutesFromArrival", "[wheel2]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    const uint64_t received_ms = 20ull * 60 * 1000;
+    set_mock_time(received_ms * 1000);
+    constexpr uint8_t payload[] = {0xfe, 0xed, 0xf0, 0x0d};
+    //clock not set yet, so not turned away as too old
+    const auto frame = airFrame(noiseEncrypted, 3, 1, 0x1a4d912f6a99af5e, payload);
+    processor.processWrite(connection, 0, frame.data(), frame.size());
+    REQUIRE(tracker.getAnyPacket() != nullptr);
+
+    set_mock_time((received_ms + 9ull * 60 * 1000) * 1000);
+    tracker.advanceExpiry(expiry_work_budget);
+    REQUIRE(tracker.getAnyPacket() != nullptr);
+    REQUIRE(0 == tracker.getExpired()[expiry_packet]);
+
+    set_mock_time((received_ms + ten_minutes_in_ms + expiry_wheel_tick_ms) * 1000);
+    //one entry each for the packet, its admission record and the connection
+    for (int pass = 0; pass < 3; pass++) {
+        tracker.advanceExpiry(1);
+    }
+    REQUIRE(tracker.getAnyPacket() == nullptr);
+    REQUIRE(1 == tracker.getExpired()[expiry_packet]);
+    REQUIRE(1 == tracker.getExpired()[expiry_admitted]);
+    //the connection was never reported connected so it goes as well
+    REQUIRE(1 == tracker.getExpired()[expiry_connection]);
+    REQUIRE(0 == tracker.getConnectionsCount());
+    tracker.printStats();
+    set_mock_time(0);
+}
+
+TEST_CASE("TrackerEvictsAndRefusesUnderPressure", "[memory2]") {
+    TrackerUnderTest under_test;
+    auto &[tracker, processor] = under_test;
+    BleConnection &connection = tracker.connectionForConnHandle(1);
+    connection.setConnected(true);
+    const auto slot = tracker.connectionSlot(connection);
+    auto store = [&tracker](const uint64_t index, const uint8_t ttl) {
+        return storePassAlong(tracker, index, std::string(100, 'p'), ttl);
+    };
+    const auto oldest = store(0, 7);
+    const auto few_hops = store(1, 2);
+    const auto delivered = store(2, 7);
+    const auto newest = store(3, 7);
+    tracker.packetForHandle(delivered)->markDeliveredTo(slot);
+    tracker.measureMemory();
+    auto &memory = tracker.getMemoryBudget();
+    const auto packet_bytes = memory.getUsed(memory_store_packets) / 4;
+    REQUIRE(packet_bytes >= 100);
+
+    //three quarters of five packets is soft pressure, one eviction brings it back under
+    memory.setBudget(memory_store_packets, packet_bytes * 5);
+    tracker.relieveMemoryPressure();
+    REQUIRE(nullptr == tracker.packetForHandle(delivered));
+    REQUIRE(3 * packet_bytes == memory.getUsed(memory_store_packets));
+    memory.setBudget(memory_store_packets, packet_bytes * 4);
+    tracker.relieveMemoryPressure();
+    REQUIRE(nullptr == tracker.packetForHandle(few_hops));
+    REQUIRE(nullptr != tracker.packetForHandle(oldest));
+    REQUIRE(nullptr != tracker.packetForHandle(newest));
+    REQUIRE(2 == memory.getEvictions(memory_store_packets));
+    tracker.relieveMemoryPressure();
+    REQUIRE(2 == memory.getEvictions(memory_store_packets));
+
+    //the total past its budget does not turn a packet away, it may be stores a packet doesn't grow that are full
+    memory.setTotalBudget(packet_bytes);
+    tracker.measureMemory();
+    auto write_frame = [&](const uint16_t tag) {
+        const uint8_t payload[] = {static_cast<uint8_t>(tag >> 8), static_cast<uint8_t>(tag), 0xca, 0xfe};
+        const auto frame = airFrame(noiseEncrypted, 3, 1000, 0x1a4d912f6a99af5e, payload);
+        processor.processWrite(connection, 0, frame.data(), frame.size());
+    };
+    write_frame(0xc0de);
+    REQUIRE(0 == tracker.getAdmissionRejects()[admission_reject_memory]);
+    memory.setTotalBudget(memory_total_budget);
+
+    //a store the packet would go in that is still over budget once eviction has had its pass does
+    memory.setUsed(memory_store_messages, memory.getBudget(memory_store_messages));
+    write_frame(0xc0df);
+    REQUIRE(1 == tracker.getAdmissionRejects()[admission_reject_memory]);
+    memory.setUsed(memory_store_neighbours, memory.getBudget(memory_store_neighbours));
+    constexpr bd_addr_t address{1, 2, 3, 4, 5, 6};
+    tracker.addAvailablePeer(address, BD_ADDR_TYPE_LE_PUBLIC, service_uuid_check_status{}, -60);
+    REQUIRE(2 == memory.getRefusals());
+    REQUIRE(1 == tracker.getConnectionsCount());
+
+    //peers are let go of least recently seen first
+    for (uint64_t id = 1; id <= 4; id++) {
+        set_mock_time(id * 1000);
+        tracker.checkSenderInPeers(id);
+    }
+    tracker.checkSenderInPeers(1);
+    tracker.measureMemory();
+    memory.setBudget(memory_store_peers, memory.getUsed(memory_store_peers));
+    tracker.relieveMemoryPressure();
+    REQUIRE(nullptr != tracker.peerWithId(1));
+    REQUIRE(nullptr == tracker.peerWithId(2));
+    REQUIRE(memory_pressure_none == memory.getPressure(memory_store_peers));
+    REQUIRE(0 < memory.getEvictions(memory_store_peers));
+    set_mock_time(0);
+    tracker.printStats();
+}
+
+TEST_CASE("PeerTableBoundedAndAging", "[peers1]") {
+    TrackerUnderTest under_test;
+    auto &tracker = under_test.tracker;
+    const uint64_t start_ms = 60ull * 60 * 1000;
+    for (uint64_t id = 1; id <= max_peers; id++) {
+        set_mock_time((start_ms + id) * 1000);
+        tracker.checkSenderInPeers(id).updateName("peer");
+    }
+    tracker.setConnectionHandleForPeer(2, 2);
+    REQUIRE(tracker.peerWithConnectionHandle(2) == tracker.peerWithId(2));
+
+    //the first is heard from again, so the second is the one seen longest ago when the table is full
+    set_mock_time((start_ms + max_peers + 1) * 1000);
+    tracker.checkSenderInPeers(1);
+    tracker.checkSenderInPeers(max_peers + 1);
+    REQUIRE(max_peers == tracker.getPeersCount());
+    REQUIRE(1 == tracker.getPeerEvictions());
+    REQUIRE(nullptr == tracker.peerWithId(2));
+    REQUIRE(nullptr != tracker.peerWithId(1));
+    //the connection still names the peer by id, it is just no longer found
+    REQUIRE(nullptr == tracker.peerWithConnectionHandle(2));
+    tracker.checkSenderInPeers(2);
+    REQUIRE(tracker.peerWithConnectionHandle(2) == tracker.peerWithId(2));
+    REQUIRE(2 == tracker.getPeerEvictions());
+
+    //only the ones heard from in the last half hour are kept
+    set_mock_time((start_ms + peer_idle_ms - 60 * 1000) * 1000);
+    tracker.checkSenderInPeers(7);
+    set_mock_time((start_ms + peer_idle_ms + 60 * 1000) * 1000);
+    tracker.cleanupStaleItems();
+    REQUIRE(1 == tracker.getPeersCount());
+    REQUIRE(nullptr != tracker.peerWithId(7));
+    REQUIRE(max_peers - 1 == tracker.getExpired()[expiry_peer]);
+    set_mock_time((start_ms + 2 * peer_idle_ms) * 1000);
+    tracker.cleanupStaleItems();
+    REQUIRE(0 == tracker.getPeersCount());
+    tracker.printStats();
+    set_mock_time(0);
+}
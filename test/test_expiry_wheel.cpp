@@ -0,0 +1,44 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "../BLE/ExpiryWheel.h"
+
+TEST_CASE("ExpiryWheelSpreadsExpiry", "[wheel1]") {
+    ExpiryWheel wheel;
+    std::vector<uint64_t> expired_keys;
+    auto collect = [&expired_keys](const ExpiryEntry &entry) {
+        expired_keys.push_back(entry.key);
+    };
+    for (uint64_t key = 0; key < 10; key++) {
+        wheel.schedule(0, key, 60 * 1000);
+    }
+    //more than a turn of the wheel away, shares a slot with the others but isn't due with them
+    wheel.schedule(0, 100, 60 * 1000 + expiry_wheel_tick_ms * expiry_wheel_slots);
+    REQUIRE(11 == wheel.size());
+    REQUIRE(0 == wheel.advance(59 * 1000, UINT32_MAX, collect));
+
+    //the work is spread over as many passes as the budget needs, the entry not yet due counts as work too
+    uint32_t passes = 0;
+    while (expired_keys.size() < 10) {
+        REQUIRE(wheel.advance(60 * 1000, 4, collect) <= 4);
+        passes++;
+    }
+    REQUIRE(3 == passes);
+    REQUIRE(0 == wheel.advance(60 * 1000, 4, collect));
+    REQUIRE(1 == wheel.size());
+
+    //long after, already due when scheduled, picked up on the next pass along with what was left
+    wheel.schedule(0, 200, 0);
+    expired_keys.clear();
+    REQUIRE(2 == wheel.advance(60ull * 60 * 1000, UINT32_MAX, collect));
+    REQUIRE(std::ranges::is_permutation(std::vector<uint64_t>{100, 200}, expired_keys));
+    REQUIRE(0 == wheel.size());
+}
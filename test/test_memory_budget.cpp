@@ -0,0 +1,26 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <catch2/catch_test_macros.hpp>
+
+#include "../BLE/MemoryBudget.h"
+
+TEST_CASE("MemoryBudgetEvictsUnderPressure", "[memory1]") {
+    MemoryBudget budget;
+    budget.setBudget(memory_store_packets, 1000);
+    budget.setUsed(memory_store_packets, 700);
+    REQUIRE(memory_pressure_none == budget.getPressure());
+    budget.charge(memory_store_packets, 50);
+    REQUIRE(memory_pressure_soft == budget.getPressure(memory_store_packets));
+    budget.charge(memory_store_packets, 250);
+    REQUIRE(memory_pressure_hard == budget.getPressure());
+    budget.release(memory_store_packets, 2000);
+    REQUIRE(0 == budget.getUsed(memory_store_packets));
+    budget.setTotalBudget(100);
+    budget.setUsed(memory_store_peers, 100);
+    REQUIRE(memory_pressure_none == budget.getPressure(memory_store_peers));
+    REQUIRE(memory_pressure_hard == budget.getPressure());
+}
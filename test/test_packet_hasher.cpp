@@ -0,0 +1,81 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <string>
+
+#include "Debugging.h"
+#include "allocation_counter.h"
+#include "../Bitchat/PacketHash.h"
+#include "../Bitchat/PacketPassAlong.h"
+
+TEST_CASE("PacketHashStableAcrossPlatforms", "[hash1]") {
+    //published XXH64 values, a hash that moved with the compiler or the cpu would miss these
+    REQUIRE(0xef46db3751d8e999 == PacketHasher().finish());
+    REQUIRE(0x44bc2cf5ad770999 == PacketHasher().add(std::string_view("abc")).finish());
+    const std::string_view text = "Nobody inspects the spammish repetition, a stripe or two past the first";
+    REQUIRE(0xa5db2864bb9d89dc == PacketHasher().add(text).finish());
+    REQUIRE(0x1a2d7ef214678220 == PacketHasher(2654435761).add(text).finish());
+    //however the bytes are split between calls
+    for (size_t chunk = 1; chunk < 40; chunk++) {
+        PacketHasher hasher;
+        for (size_t pos = 0; pos < text.size(); pos += chunk) {
+            hasher.add(text.substr(pos, chunk));
+        }
+        REQUIRE(0xa5db2864bb9d89dc == hasher.finish());
+    }
+
+    constexpr uint64_t timestamp = 0x19893abb14c;
+    constexpr uint64_t sender = 0x4feddd326fb00c2b;
+    constexpr uint64_t broadcast_recipient = 0xffffffffffffffff;
+    REQUIRE(0x5bd20f090602158f == PacketPassAlong::packetHash(type_message, 1, timestamp, sender, broadcast_recipient,
+                                                              "hello"));
+    const auto wide = PacketPassAlong::packetHash128(type_message, 1, timestamp, sender, broadcast_recipient, "hello");
+    REQUIRE(0x5bd20f090602158f == wide.high);
+    REQUIRE(0xa41b313b9298f66c == wide.low);
+    REQUIRE(wide != PacketPassAlong::packetHash128(type_message, 1, timestamp, sender, broadcast_recipient, "hellp"));
+
+    //the std::hash version it replaces, which gathered the header into a buffer and hashed it apart from the payload
+    auto std_hash = [](const uint8_t type, const uint8_t flags, const uint64_t timestamp, const uint64_t sender,
+                       const uint64_t recipient, const std::string_view payload) {
+        const std::size_t hash_payload = std::hash<std::string_view>{}(payload);
+        std::array<uint8_t, 2 + 3 * sizeof(uint64_t)> meta{type, flags};
+        auto pos = 2;
+        for (const auto value: {timestamp, sender, recipient}) {
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                meta[pos++] = static_cast<uint8_t>(value >> shift);
+            }
+        }
+        const std::size_t hash_meta = std::hash<std::string_view>{}(
+            std::string_view(reinterpret_cast<const char *>(meta.data()), meta.size()));
+        return hash_payload ^ (hash_meta << 1);
+    };
+    constexpr int rounds = 20000;
+    for (const size_t payload_size: {16, 160, 480}) {
+        std::string payload(payload_size, 'x');
+        uint64_t sink = 0;
+        const auto std_start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            sink += std_hash(type_message, 1, timestamp + i, sender, broadcast_recipient, payload);
+        }
+        const auto std_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - std_start).count();
+        const auto allocations_before = allocation_count;
+        const auto xxh_start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            sink += PacketPassAlong::packetHash(type_message, 1, timestamp + i, sender, broadcast_recipient, payload);
+        }
+        const auto xxh_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - xxh_start).count();
+        REQUIRE(allocation_count == allocations_before);
+        LOG_DEBUG("packet hash of %zu byte payload - std::hash: %" PRId64 "ns, xxh64: %" PRId64 "ns (%" PRIx64 ")\n",
+                  payload_size, static_cast<int64_t>(std_ns) / rounds, static_cast<int64_t>(xxh_ns) / rounds, sink);
+    }
+}
@@ -0,0 +1,47 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../Bitchat/PacketPassAlong.h"
+#include "../BLE/BleConnectionTracker.h"
+#include "../BLE/PacketPool.h"
+
+TEST_CASE("PacketPoolHandlesDetectStaleSlots", "[pool1]") {
+    PacketPool<PacketPassAlong, 4, packet_pool_pass_along> pool;
+    auto make = [](const uint64_t timestamp) {
+        PacketPassAlong pass_along(noiseEncrypted, 7, timestamp, 0, 0x1a4d912f6a99af5e, 0);
+        std::string payload = "pool payload";
+        pass_along.setPayload(payload);
+        return pass_along;
+    };
+    std::vector<PacketHandle> handles;
+    for (uint64_t i = 0; i < 4; i++) {
+        handles.push_back(pool.insert(i, make(0x198d35e50ee + 10 - i)));
+    }
+    REQUIRE(4 == pool.size());
+    REQUIRE(handles[2] == pool.find(2));
+    REQUIRE_FALSE(pool.find(4));
+    REQUIRE(0x198d35e50ee + 8 == pool.get(handles[2])->getPacketTimestamp());
+
+    //full, the oldest goes and its handle stops resolving even though the slot is in use again
+    const auto newest = pool.insert(4, make(0x198d35e50ee + 20));
+    REQUIRE(1 == pool.getEvictions());
+    REQUIRE(nullptr == pool.get(handles[3]));
+    REQUIRE(handles[3].getIndex() == newest.getIndex());
+    REQUIRE(handles[3].getGeneration() != newest.getGeneration());
+    REQUIRE(pool.get(newest) != nullptr);
+
+    pool.erase(handles[0]);
+    REQUIRE(nullptr == pool.get(handles[0]));
+    pool.erase(handles[0]); //erasing through a stale handle leaves the reused slot alone
+    REQUIRE(3 == pool.size());
+    REQUIRE(nullptr == pool.get(PacketHandle{packet_pool_messages, handles[1].getIndex(), handles[1].getGeneration()}));
+    REQUIRE(nullptr == pool.get(PacketHandle{}));
+}
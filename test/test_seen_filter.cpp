@@ -0,0 +1,54 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+
+#include "Debugging.h"
+#include "../Bitchat/PacketHash.h"
+#include "../BLE/SeenFilter.h"
+
+TEST_CASE("SeenFilterRemembersKeysPastTheStores", "[seen1]") {
+    SeenFilter filter;
+    uint64_t now_ms = 1000;
+    auto key = [](const uint64_t i) {
+        return PacketHasher(i).add(i).finish();
+    };
+    for (uint64_t i = 0; i < seen_filter_capacity - 1; i++) {
+        filter.insert(key(i), now_ms);
+    }
+    REQUIRE(seen_filter_capacity - 1 == filter.getKeys());
+    for (uint64_t i = 0; i < seen_filter_capacity - 1; i++) {
+        REQUIRE(filter.contains(key(i)));
+    }
+    //one generation at capacity, what is measured should be close to what is reported
+    constexpr int probes = 100000;
+    int false_positives = 0;
+    for (uint64_t i = 0; i < probes; i++) {
+        false_positives += filter.contains(key(i + 0x100000000));
+    }
+    const auto measured = static_cast<float>(false_positives) / probes;
+    LOG_DEBUG("seen filter at capacity - fill: %.1f%%, false positive measured: %.3f%%, estimated: %.3f%%\n",
+              filter.getFill() * 100, measured * 100, filter.getFalsePositiveRate() * 100);
+    REQUIRE(filter.getFalsePositiveRate() < 0.001f);
+    REQUIRE(measured < filter.getFalsePositiveRate() * 2);
+    REQUIRE(measured > filter.getFalsePositiveRate() / 2);
+
+    //a full generation is retired early, its keys are still remembered from the older one
+    filter.insert(key(seen_filter_capacity), now_ms);
+    filter.insert(key(seen_filter_capacity + 1), now_ms);
+    REQUIRE(filter.contains(key(0)));
+    REQUIRE(filter.contains(key(seen_filter_capacity + 1)));
+
+    //remembered for three generations at least, gone once the whole window has passed
+    now_ms += seen_filter_generation_ms * (seen_filter_generations - 1);
+    filter.expire(now_ms);
+    REQUIRE(filter.contains(key(0)));
+    now_ms += seen_filter_generation_ms;
+    filter.expire(now_ms);
+    REQUIRE_FALSE(filter.contains(key(0)));
+    REQUIRE(0 == filter.getKeys());
+}
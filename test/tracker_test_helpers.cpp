@@ -0,0 +1,64 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "tracker_test_helpers.h"
+
+#include "../Bitchat/BinaryWriter.h"
+
+BleConnectionTracker *connection_tracker_ptr = nullptr;
+
+TrackerUnderTest::TrackerUnderTest() {
+    connection_tracker_ptr = &tracker;
+}
+
+TrackerUnderTest::~TrackerUnderTest() {
+    connection_tracker_ptr = nullptr;
+}
+
+BleConnection &connectedLink(BleConnectionTracker &tracker, const hci_con_handle_t handle, const uint16_t mtu) {
+    auto &connection = tracker.connectionForConnHandle(handle);
+    connection.setConnected(true);
+    connection.setBitchatCharacteristicValueHandle(1);
+    connection.setMtu(mtu);
+    return connection;
+}
+
+PacketPassAlong passAlong(const uint64_t index, std::string payload, const uint8_t ttl) {
+    PacketPassAlong pass_along(noiseEncrypted, ttl, 0x198d35e50ee + index, 0, 0x1a4d912f6a99af5e, 0);
+    pass_along.setPayload(payload);
+    return pass_along;
+}
+
+PacketHandle storePassAlong(BleConnectionTracker &tracker, const uint64_t index, std::string payload,
+                            const uint8_t ttl) {
+    auto pass_along = passAlong(index, std::move(payload), ttl);
+    return tracker.storePacketAndReturnIfNew(pass_along);
+}
+
+void enqueueBurst(BleConnectionTracker &tracker, const uint64_t count, const std::string &payload,
+                  const uint64_t first) {
+    for (uint64_t i = first; i < first + count; i++) {
+        if (const auto stored = storePassAlong(tracker, i, payload)) {
+            tracker.enqueueBroadcastPacket(stored);
+        }
+    }
+}
+
+std::vector<uint8_t> airFrame(const uint8_t type, const uint8_t ttl, const uint64_t timestamp, const uint64_t sender,
+                              const std::span<const uint8_t> payload, const uint8_t flags) {
+    std::vector<uint8_t> frame;
+    const BinaryWriter writer(frame);
+    writer.write_uint8(1);
+    writer.write_uint8(type);
+    writer.write_uint8(ttl);
+    writer.write_uint64(timestamp);
+    writer.write_uint8(flags);
+    writer.write_uint16(payload.size());
+    writer.write_uint64(sender);
+    writer.write_data(payload.data(), payload.size());
+    writer.write_uint8(0);
+    return frame;
+}
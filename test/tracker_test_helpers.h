@@ -0,0 +1,48 @@
+/**
+* SPDX-FileCopyrightText: 2025, Adam Boardman
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TRACKER_TEST_HELPERS_H
+#define TRACKER_TEST_HELPERS_H
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "pico_pi_mocks.h"
+#include "../BLE/BleConnectionTracker.h"
+#include "../Bitchat/ProtocolProcessor.h"
+
+//the tracker the mocked btstack callbacks report to
+extern BleConnectionTracker *connection_tracker_ptr;
+
+//A tracker the mocks call back into and a processor feeding it, where most tracker tests start
+struct TrackerUnderTest {
+    BleConnectionTracker tracker;
+    const ProtocolProcessor processor{tracker};
+
+    TrackerUnderTest();
+
+    ~TrackerUnderTest();
+};
+
+//A link that is up with the bitchat characteristic found, an mtu of 0 leaves the default
+BleConnection &connectedLink(BleConnectionTracker &tracker, hci_con_handle_t handle, uint16_t mtu = 0);
+
+//A relayed packet of the kind the send tests queue, told apart from the others by its index
+PacketPassAlong passAlong(uint64_t index, std::string payload, uint8_t ttl = 7);
+
+//an empty handle if it was stored already
+PacketHandle storePassAlong(BleConnectionTracker &tracker, uint64_t index, std::string payload, uint8_t ttl = 7);
+
+//stores count packets numbered on from first, queueing each one that is new for broadcast
+void enqueueBurst(BleConnectionTracker &tracker, uint64_t count, const std::string &payload, uint64_t first = 0);
+
+//A frame as it arrives over the air, without a recipient or signature
+std::vector<uint8_t> airFrame(uint8_t type, uint8_t ttl, uint64_t timestamp, uint64_t sender,
+                              std::span<const uint8_t> payload, uint8_t flags = 0);
+
+#endif //TRACKER_TEST_HELPERS_H